@@ -0,0 +1,440 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <functional>
+#include <string>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "audiophash.h"
+#include "ph_fft.h"
+#include "legacyaudiohash.h"
+#include "hash.h"
+#include "minuscompare.h"
+#include "troughcompare.h"
+#include "spectrumcompare.h"
+#include "correlator.h"
+#include "audiohasher.h"
+
+/** Benchmarks for the comparison engines. Everything runs on synthetic audio so no sound card is needed **/
+
+static const int SAMPLE_RATE = 48000;
+static const int HASH_FRAME = 4096;
+static const int HASH_ADVANCE = HASH_FRAME/32;
+
+//count every allocation so the benchmarks can show which engines allocate on each call
+static std::atomic<unsigned long long> g_nAllocations(0);
+static std::atomic<unsigned long long> g_nAllocatedBytes(0);
+
+void* operator new(size_t nSize)
+{
+    g_nAllocations.fetch_add(1, std::memory_order_relaxed);
+    g_nAllocatedBytes.fetch_add(nSize, std::memory_order_relaxed);
+    void* pMemory = std::malloc(nSize ? nSize : 1);
+    if(!pMemory)
+    {
+        throw std::bad_alloc();
+    }
+    return pMemory;
+}
+
+void* operator new[](size_t nSize)
+{
+    return operator new(nSize);
+}
+
+void operator delete(void* pMemory) noexcept
+{
+    std::free(pMemory);
+}
+
+void operator delete[](void* pMemory) noexcept
+{
+    std::free(pMemory);
+}
+
+void operator delete(void* pMemory, size_t) noexcept
+{
+    std::free(pMemory);
+}
+
+void operator delete[](void* pMemory, size_t) noexcept
+{
+    std::free(pMemory);
+}
+
+std::vector<float> CreateNoise(size_t nSamples, unsigned int nSeed)
+{
+    std::mt19937 gen(nSeed);
+    std::normal_distribution<float> dist(0.0, 0.1);
+    std::vector<float> vNoise(nSamples);
+    for(auto& dSample : vNoise)
+    {
+        dSample = dist(gen);
+    }
+    return vNoise;
+}
+
+/** Runs func nRepeats times and returns the mean time per run in microseconds **/
+double Time(const std::function<void()>& func, size_t nRepeats)
+{
+    func(); //warm up - creates any cached plans
+    auto tpStart = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < nRepeats; i++)
+    {
+        func();
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-tpStart);
+    return duration.count()/1000.0/nRepeats;
+}
+
+void Report(const std::string& sName, double dMicroseconds)
+{
+    std::cout << std::left << std::setw(40) << sName << std::right << std::setw(12) << std::fixed << std::setprecision(1) << dMicroseconds << " us per second of audio" << std::endl;
+}
+
+void BenchmarkHashFFT(size_t nRepeats)
+{
+    //the number of frames ph_audiohash transforms for one second of audio
+    size_t nFrames = (SAMPLE_RATE-HASH_FRAME)/HASH_ADVANCE+1;
+    auto vAudio = CreateNoise(HASH_FRAME, 1);
+
+    std::vector<double> vLegacyIn(vAudio.begin(), vAudio.end());
+    std::vector<complex<double>> vLegacyOut(HASH_FRAME);
+    Report("phash FFT (recursive, legacy)", Time([&]()
+    {
+        for(size_t i = 0; i < nFrames; i++)
+        {
+            fft(vLegacyIn.data(), HASH_FRAME, vLegacyOut.data());
+        }
+    }, nRepeats));
+
+    kiss_fftr_cfg cfg = kiss_fftr_alloc(HASH_FRAME, 0, NULL, NULL);
+    std::vector<kiss_fft_cpx> vOut(HASH_FRAME/2+1);
+    Report("phash FFT (kiss_fftr, planned)", Time([&]()
+    {
+        for(size_t i = 0; i < nFrames; i++)
+        {
+            kiss_fftr(cfg, vAudio.data(), vOut.data());
+        }
+    }, nRepeats));
+    free(cfg);
+}
+
+void BenchmarkAudioHash(size_t nRepeats)
+{
+    auto vAudio = CreateNoise(SAMPLE_RATE, 2);
+    Report("ph_audiohash (per call, legacy)", Time([&]()
+    {
+        int nFrames;
+        uint32_t* pHash = ph_audiohash_legacy(vAudio.data(), vAudio.size(), SAMPLE_RATE, nFrames, false);
+        free(pHash);
+    }, nRepeats));
+
+    Report("ph_audiohash", Time([&]()
+    {
+        int nFrames;
+        uint32_t* pHash = ph_audiohash(vAudio.data(), vAudio.size(), SAMPLE_RATE, nFrames);
+        free(pHash);
+    }, nRepeats));
+}
+
+/** Prints how many bits of hashes made by two versions of ph_audiohash from the same audio differ. Takes ownership of both hashes **/
+void ReportHashBits(const std::string& sName, unsigned int nSeed, uint32_t* pHashA, int nFramesA, uint32_t* pHashB, int nFramesB)
+{
+    std::cout << std::left << std::setw(40) << sName << " seed " << nSeed << ": ";
+    if(!pHashA || !pHashB || nFramesA != nFramesB)
+    {
+        std::cout << "FAILED to hash" << std::endl;
+    }
+    else
+    {
+        std::cout << ph_hamming_distance(pHashA, pHashB, nFramesA) << " of " << nFramesA*32 << " bits differ" << std::endl;
+    }
+    free(pHashA);
+    free(pHashB);
+}
+
+/** Checks the hash bits of each change to ph_audiohash against the version before it on two seconds of noise **/
+void CheckAudioHash()
+{
+    std::cout << std::endl;
+    for(unsigned int nSeed = 1; nSeed <= 3; nSeed++)
+    {
+        auto vAudio = CreateNoise(2*SAMPLE_RATE, nSeed);
+
+        int nRecursive, nKiss;
+        uint32_t* pRecursive = ph_audiohash_legacy(vAudio.data(), vAudio.size(), SAMPLE_RATE, nRecursive, false);
+        uint32_t* pKiss = ph_audiohash_legacy(vAudio.data(), vAudio.size(), SAMPLE_RATE, nKiss, true);
+        ReportHashBits("hash: recursive fft vs kiss_fftr", nSeed, pRecursive, nRecursive, pKiss, nKiss);
+
+        int nDense, nSparse;
+        uint32_t* pDense = ph_audiohash_legacy(vAudio.data(), vAudio.size(), SAMPLE_RATE, nDense, true);
+        uint32_t* pSparse = ph_audiohash(vAudio.data(), vAudio.size(), SAMPLE_RATE, nSparse);
+        ReportHashBits("hash: dense vs sparse bark filterbank", nSeed, pDense, nDense, pSparse, nSparse);
+    }
+}
+
+/** Two legs of band limited noise with the A leg lagging the B leg by dDelay samples, which need not be a whole number.
+*   Both legs are the same noise through a Hann windowed sinc low pass at 0.45 of the sample rate, evaluated dDelay samples earlier for A,
+*   so the delay between them is exact. Independent noise dNoise times the signal level is added to A
+**/
+struct fractionalLegs
+{
+    fractionalLegs(size_t nWindow, double dDelay, double dNoise, unsigned int nSeed) : vA(nWindow), vB(nWindow)
+    {
+        const long nTaps = 32;
+        long nShift = static_cast<long>(std::ceil(std::fabs(dDelay)));
+        auto vSource = CreateNoise(nWindow+nShift+2*nTaps+1, nSeed);
+        auto vNoise = CreateNoise(nWindow, nSeed+1000);
+
+        auto LowPass = [&](double dPosition)
+        {
+            double dSum = 0.0;
+            long nCentre = static_cast<long>(std::floor(dPosition));
+            for(long k = nCentre-nTaps+1; k <= nCentre+nTaps; k++)
+            {
+                double x = dPosition-k;
+                double dWindow = 0.5*(1.0+std::cos(M_PI*x/nTaps));
+                double dSinc = (x == 0.0 ? 1.0 : std::sin(0.9*M_PI*x)/(0.9*M_PI*x));
+                dSum += vSource[k]*0.9*dSinc*dWindow;
+            }
+            return dSum;
+        };
+
+        for(size_t i = 0; i < nWindow; i++)
+        {
+            double dPosition = static_cast<double>(i+nTaps+nShift);
+            vB[i] = LowPass(dPosition);
+            vA[i] = LowPass(dPosition-dDelay) + dNoise*vNoise[i];
+        }
+    }
+
+    AudioView A() const { return AudioView(vA.data(), vA.size()); }
+    AudioView B() const { return AudioView(vB.data(), vB.size()); }
+
+    std::vector<float> vA;
+    std::vector<float> vB;
+};
+
+/** Times the coarse to fine delay search against one full length correlation of the same window and shows how far apart their answers are **/
+void CompareCoarseToFine(size_t nRepeats)
+{
+    std::cout << std::endl << std::left << std::setw(22) << "coarse to fine" << std::right << std::setw(9) << "window" << std::setw(11) << "delay"
+              << std::setw(12) << "full" << std::setw(12) << "c2f" << std::setw(10) << "diff" << std::setw(11) << "full ms" << std::setw(10) << "c2f ms" << std::endl;
+
+    for(size_t nWindow : {131072, 262144})
+    {
+        for(double dFraction : {-0.45, -0.2, 0.0, 0.05, 0.3, 0.45})
+        {
+            double dDelay = std::round(dFraction*nWindow)+0.3;
+            fractionalLegs theLegs(nWindow, dDelay, 0.5, 4);
+
+            delayEstimate full, coarse;
+            double dFull = Time([&]{ full = GetCorrelator(nWindow).EstimateDelay(theLegs.A(), theLegs.B()); }, nRepeats);
+            double dCoarse = Time([&]{ coarse = EstimateDelayCoarseToFine(theLegs.A(), theLegs.B()); }, nRepeats);
+
+            std::cout << std::left << std::setw(22) << "" << std::right << std::setw(9) << nWindow << std::fixed << std::setprecision(1) << std::setw(11) << dDelay
+                      << std::setprecision(3) << std::setw(12) << full.dOffset << std::setw(12) << coarse.dOffset << std::setw(10) << std::fabs(full.dOffset-coarse.dOffset)
+                      << std::setprecision(1) << std::setw(11) << dFull/1000.0 << std::setw(10) << dCoarse/1000.0 << std::endl;
+        }
+    }
+}
+
+/** Measures how close the interpolated delay of each correlator is to a known fractional delay.
+*   The one shot correlator looks at a single window. The streaming correlator is fed the windows a block at a time as compi would
+**/
+void CheckSubSampleDelay()
+{
+    const size_t nWindow = 8192;
+    const size_t nBlock = 1024;
+    const size_t nSamples = SAMPLE_RATE*2;
+
+    std::cout << std::endl << std::left << std::setw(22) << "sub-sample delay" << std::right << std::setw(10) << "delay"
+              << std::setw(12) << "one shot" << std::setw(10) << "error" << std::setw(12) << "streaming" << std::setw(10) << "error" << std::endl;
+
+    double dWorst(0.0);
+    for(double dDelay : {0.0, 0.25, 0.5, 0.75, 10.3, -37.6, 100.9})
+    {
+        fractionalLegs theLegs(nSamples, dDelay, 0.3, 5);
+
+        size_t nEnd = nSamples-nBlock;
+        delayEstimate oneShot = GetCorrelator(nWindow).EstimateDelay(AudioView(theLegs.vA.data()+nEnd-nWindow, nWindow, nEnd-nWindow),
+                                                                    AudioView(theLegs.vB.data()+nEnd-nWindow, nWindow, nEnd-nWindow));
+
+        StreamingCorrelator correlator;
+        delayEstimate streaming;
+        for(size_t nPosition = nWindow; nPosition <= nEnd; nPosition += nBlock)
+        {
+            streaming = correlator.EstimateDelay(AudioView(theLegs.vA.data()+nPosition-nWindow, nWindow, nPosition-nWindow),
+                                                 AudioView(theLegs.vB.data()+nPosition-nWindow, nWindow, nPosition-nWindow));
+        }
+
+        dWorst = std::max(dWorst, std::max(std::fabs(oneShot.dOffset-dDelay), std::fabs(streaming.dOffset-dDelay)));
+        std::cout << std::left << std::setw(22) << "" << std::right << std::fixed << std::setprecision(2) << std::setw(10) << dDelay
+                  << std::setprecision(3) << std::setw(12) << oneShot.dOffset << std::setw(10) << std::fabs(oneShot.dOffset-dDelay)
+                  << std::setw(12) << streaming.dOffset << std::setw(10) << std::fabs(streaming.dOffset-dDelay) << std::endl;
+    }
+    std::cout << std::left << std::setw(22) << "" << "worst error " << std::setprecision(3) << dWorst << " samples ("
+              << std::setprecision(1) << dWorst*1e6/SAMPLE_RATE << "us)" << std::endl;
+}
+
+/** Peak resident set size of the process so far in KiB **/
+long GetPeakRss()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/** A pair of legs made from the same noise with the B leg lagging the A leg by nDelay samples **/
+struct legs
+{
+    legs(size_t nWindow, size_t nDelay, unsigned int nSeed) : vSource(CreateNoise(nWindow+nDelay, nSeed)), nWindow(nWindow), nDelay(nDelay){}
+
+    AudioView A(size_t nPosition) const { return AudioView(vSource.data()+nDelay, nWindow, nPosition); }
+    AudioView B(size_t nPosition) const { return AudioView(vSource.data(), nWindow, nPosition); }
+
+    std::vector<float> vSource;
+    size_t nWindow;
+    size_t nDelay;
+};
+
+/** Runs func (which is passed the capture position of the window) nRepeats times after a warm up and prints the time per sample,
+*   the allocations per call and the peak RSS so far
+**/
+void Measure(const std::string& sName, const legs& theLegs, const std::function<void(size_t)>& func, size_t nRepeats)
+{
+    size_t nPosition(0);
+    func(nPosition);    //warm up - creates any cached plans and buffers
+    nPosition += theLegs.nWindow;
+
+    unsigned long long nAllocations = g_nAllocations.load();
+    unsigned long long nBytes = g_nAllocatedBytes.load();
+    auto tpStart = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < nRepeats; i++)
+    {
+        func(nPosition);
+        nPosition += theLegs.nWindow;
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-tpStart);
+
+    double dNsPerSample = static_cast<double>(duration.count())/nRepeats/theLegs.nWindow;
+    double dAllocations = static_cast<double>(g_nAllocations.load()-nAllocations)/nRepeats;
+    double dKiB = static_cast<double>(g_nAllocatedBytes.load()-nBytes)/nRepeats/1024.0;
+
+    std::cout << std::left << std::setw(22) << sName << std::right
+              << std::setw(9) << theLegs.nWindow
+              << std::setw(8) << theLegs.nDelay
+              << std::fixed << std::setprecision(2) << std::setw(12) << dNsPerSample
+              << std::setprecision(1) << std::setw(10) << dAllocations
+              << std::setw(12) << dKiB
+              << std::setw(12) << GetPeakRss()/1024.0 << std::endl;
+}
+
+void BenchmarkEngines(size_t nRepeats, const std::string& sFilter)
+{
+    std::cout << std::endl << std::left << std::setw(22) << "engine" << std::right << std::setw(9) << "window" << std::setw(8) << "delay"
+              << std::setw(12) << "ns/sample" << std::setw(10) << "allocs" << std::setw(12) << "KiB/call" << std::setw(12) << "peak MiB" << std::endl;
+
+    //windows from a short locked window up to the 2 seconds either side searched with the default maximum delay
+    const std::vector<size_t> vWindows{4800, 24000, 96000, 384000};
+    const std::vector<size_t> vDelays{0, 480, 4800};
+
+    std::string sProfile = "/tmp/compi_bench_"+std::to_string(getpid())+".profile";
+
+    for(auto nWindow : vWindows)
+    {
+        for(auto nDelay : vDelays)
+        {
+            if(nDelay*2 >= nWindow)
+            {
+                continue;
+            }
+            legs theLegs(nWindow, nDelay, 3);
+            size_t nSampleSize = nWindow/2;     //the part of the window that is compared once the legs are lined up
+
+            auto Run = [&](const std::string& sName, const std::function<void(size_t)>& func)
+            {
+                if(sFilter.empty() || sName.find(sFilter) != std::string::npos)
+                {
+                    Measure(sName, theLegs, func, nRepeats);
+                }
+            };
+
+            Run("CalculateOffset", [&](size_t nPosition){ CalculateOffset(theLegs.A(nPosition), theLegs.B(nPosition)); });
+            Run("CheckForTone", [&](size_t nPosition){ CheckForTone(theLegs.A(nPosition), theLegs.B(nPosition)); });
+
+            //the work the offset, hash and publish stages do for one hash comparison, one after the other
+            StreamingCorrelator correlator;
+            AudioHasher hasherA(SAMPLE_RATE), hasherB(SAMPLE_RATE);
+            Run("HashPipeline", [&](size_t nPosition)
+            {
+                AudioView bufferA(theLegs.A(nPosition)), bufferB(theLegs.B(nPosition));
+                hasherA.AddAudio(bufferA);
+                hasherB.AddAudio(bufferB);
+                if(CheckForTone(bufferA, bufferB) == false)
+                {
+                    hashrange rangeA, rangeB;
+                    if(GetHashRanges(bufferA, bufferB, nSampleSize, correlator.EstimateDelay(bufferA, bufferB).nOffset, rangeA, rangeB))
+                    {
+                        size_t nFirstA, nFirstB;
+                        std::vector<uint32_t> vHashA(hasherA.GetHashes(rangeA.first, rangeA.second, nFirstA));
+                        std::vector<uint32_t> vHashB(hasherB.GetHashes(rangeB.first, rangeB.second, nFirstB));
+                        AlignHashes(vHashA, PositionDistance(rangeA.first, nFirstA), vHashB, PositionDistance(rangeB.first, nFirstB));
+                        CompareHashes(std::move(vHashA), std::move(vHashB));
+                    }
+                }
+            });
+
+            StreamingCorrelator correlatorMinus;
+            std::pair<int, double> last{0, 0.0};
+            double dMinusConfidence(0.0);
+            Run("CalculateMinus", [&](size_t nPosition){ last = CalculateMinus(theLegs.A(nPosition), theLegs.B(nPosition), peak(0.5, 0.5), nSampleSize, true, last, dMinusConfidence, correlatorMinus); });
+
+            StreamingCorrelator correlatorFFT;
+            fftDiffState fftDiff;
+            Run("CalculateFFTDiff", [&](size_t nPosition){ CalculateFFTDiff(theLegs.A(nPosition), theLegs.B(nPosition), nSampleSize, 20, 10.0, 0.05, 0.1, fftDiff, correlatorFFT); });
+
+            //learns its profile from the warm up call so the timed calls are comparing against it
+            std::remove(sProfile.c_str());
+            SpectrumCompare spectrum(sProfile, SAMPLE_RATE, 1, 5000, 3.0, 20);
+            Run("SpectrumCompare", [&](size_t nPosition){ spectrum.AddAudio(theLegs.A(nPosition), theLegs.B(nPosition)); });
+        }
+    }
+    std::remove(sProfile.c_str());
+}
+
+int main(int argc, char* argv[])
+{
+    size_t nRepeats = 10;
+    if(argc > 1)
+    {
+        nRepeats = std::max(1, std::stoi(argv[1]));
+    }
+    std::string sFilter;    //only run the engines whose name contains this
+    if(argc > 2)
+    {
+        sFilter = argv[2];
+    }
+
+    std::cout << "compi_bench: " << nRepeats << " repeats" << std::endl;
+
+    if(sFilter.empty())
+    {
+        BenchmarkHashFFT(nRepeats);
+        BenchmarkAudioHash(nRepeats);
+        CheckAudioHash();
+        CompareCoarseToFine(nRepeats);
+        CheckSubSampleDelay();
+    }
+    BenchmarkEngines(nRepeats, sFilter);
+
+    return 0;
+}
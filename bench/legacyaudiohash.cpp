@@ -0,0 +1,170 @@
+/*
+
+    pHash, the open source perceptual hash library
+    Copyright (C) 2009 Aetilius, Inc.
+    All rights reserved.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Evan Klinger - eklinger@phash.org
+    David Starkweather - dstarkweather@phash.org
+
+*/
+
+#include "legacyaudiohash.h"
+#include "ph_fft.h"
+#include "kiss_fftr.h"
+#include <algorithm>
+
+uint32_t *ph_audiohash_legacy(const float *buf, int N, int sr, int &nb_frames,
+                              bool kiss) {
+    int frame_length = 4096;  // 2^12
+    int nfft = frame_length;
+    int nfft_half = 2048;
+    int start = 0;
+    int end = start + frame_length - 1;
+    int overlap = (int)(31 * frame_length / 32);
+    int advance = frame_length - overlap;
+    int index = 0;
+    nb_frames = (int)(floor(N / advance) - floor(frame_length / advance) + 1);
+    double window[frame_length];
+    for (int i = 0; i < frame_length; i++) {
+        // hamming window
+        window[i] = 0.54 - 0.46 * cos(2 * M_PI * i / (frame_length - 1));
+    }
+
+    double frame[frame_length];
+    complex<double> *pF = new complex<double>[nfft];
+
+    // the same transform on kiss_fftr, for comparing the hash bits
+    kiss_fft_scalar kiss_frame[frame_length];
+    kiss_fft_cpx kiss_out[nfft_half + 1];
+    kiss_fftr_cfg kiss_cfg = kiss ? kiss_fftr_alloc(nfft, 0, NULL, NULL) : NULL;
+
+    double magnF[nfft_half];
+    double maxF = 0.0;
+    double maxB = 0.0;
+
+    double minfreq = 300;
+    double maxfreq = 3000;
+    double minbark = 6 * asinh(minfreq / 600.0);
+    double maxbark = 6 * asinh(maxfreq / 600.0);
+    double nyqbark = maxbark - minbark;
+    int nfilts = 33;
+    double stepbarks = nyqbark / (nfilts - 1);
+    int nb_barks = (int)(floor(nfft_half / 2 + 1));
+    double barkwidth = 1.06;
+
+    double freqs[nb_barks];
+    double binbarks[nb_barks];
+    double curr_bark[nfilts];
+    double prev_bark[nfilts];
+    for (int i = 0; i < nfilts; i++) {
+        prev_bark[i] = 0.0;
+    }
+    uint32_t *hash = (uint32_t *)malloc(nb_frames * sizeof(uint32_t));
+    double lof, hif;
+
+    for (int i = 0; i < nb_barks; i++) {
+        binbarks[i] = 6 * asinh(i * sr / nfft_half / 600.0);
+        freqs[i] = i * sr / nfft_half;
+    }
+    double **wts = new double *[nfilts];
+    for (int i = 0; i < nfilts; i++) {
+        wts[i] = new double[nfft_half];
+    }
+    for (int i = 0; i < nfilts; i++) {
+        for (int j = 0; j < nfft_half; j++) {
+            wts[i][j] = 0.0;
+        }
+    }
+
+    // calculate wts for each filter
+    for (int i = 0; i < nfilts; i++) {
+        double f_bark_mid = minbark + i * stepbarks;
+        for (int j = 0; j < nb_barks; j++) {
+            double barkdiff = binbarks[j] - f_bark_mid;
+            lof = -2.5 * (barkdiff / barkwidth - 0.5);
+            hif = barkdiff / barkwidth + 0.5;
+            double m = std::min(lof, hif);
+            m = std::min(0.0, m);
+            m = pow(10, m);
+            wts[i][j] = m;
+        }
+    }
+
+    while (end < N) {
+        maxF = 0.0;
+        maxB = 0.0;
+        if (kiss) {
+            for (int i = 0; i < frame_length; i++) {
+                kiss_frame[i] = window[i] * buf[start + i];
+            }
+            kiss_fftr(kiss_cfg, kiss_frame, kiss_out);
+            for (int i = 0; i < nfft_half; i++) {
+                magnF[i] = sqrt(kiss_out[i].r * kiss_out[i].r +
+                                kiss_out[i].i * kiss_out[i].i);
+            }
+        } else {
+            for (int i = 0; i < frame_length; i++) {
+                frame[i] = window[i] * buf[start + i];
+            }
+            if (fft(frame, frame_length, pF) < 0) {
+                free(hash);
+                hash = NULL;
+                break;
+            }
+            for (int i = 0; i < nfft_half; i++) {
+                magnF[i] = abs(pF[i]);
+            }
+        }
+        for (int i = 0; i < nfft_half; i++) {
+            if (magnF[i] > maxF) {
+                maxF = magnF[i];
+            }
+        }
+
+        for (int i = 0; i < nfilts; i++) {
+            curr_bark[i] = 0;
+            for (int j = 0; j < nfft_half; j++) {
+                curr_bark[i] += wts[i][j] * magnF[j];
+            }
+            if (curr_bark[i] > maxB) maxB = curr_bark[i];
+        }
+
+        uint32_t curr_hash = 0x00000000u;
+        for (int m = 0; m < nfilts - 1; m++) {
+            double H = curr_bark[m] - curr_bark[m + 1] -
+                       (prev_bark[m] - prev_bark[m + 1]);
+            curr_hash = curr_hash << 1;
+            if (H > 0) curr_hash |= 0x00000001;
+        }
+
+        hash[index] = curr_hash;
+        for (int i = 0; i < nfilts; i++) {
+            prev_bark[i] = curr_bark[i];
+        }
+        index += 1;
+        start += advance;
+        end += advance;
+    }
+
+    free(kiss_cfg);
+    delete[] pF;
+    for (int i = 0; i < nfilts; i++) {
+        delete[] wts[i];
+    }
+    delete[] wts;
+    return hash;
+}
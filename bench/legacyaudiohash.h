@@ -0,0 +1,24 @@
+#ifndef _LEGACY_AUDIO_PHASH_H
+#define _LEGACY_AUDIO_PHASH_H
+
+#include <stdint.h>
+
+/* /brief the original pHash ph_audiohash, kept only so compi_bench can time it
+ *        and check the hashes of the current ph_audiohash against it.
+ * purpose: computes the window and the dense 33x2048 bark weights on every
+ *          call and transforms each frame with the recursive fft() from
+ *          ph_fft.cpp, which allocates on every call.
+ *
+ * /param buf - pointer to start of buffer
+ * /param N   - length of buffer
+ * /param sr  - sample rate on which to base the audiohash
+ * /param nb_frames - (out) number of frames in audio buf and length of
+ * audiohash buffer returned
+ * /param kiss - use kiss_fftr instead of fft() so the dense bark filterbank
+ * can be compared on its own
+ * /return uint32 pointer to audio hash (free with free()), NULL for error
+ */
+uint32_t *ph_audiohash_legacy(const float *buf, int N, int sr, int &nb_frames,
+                              bool kiss);
+
+#endif
@@ -23,135 +23,184 @@
 */
 
 #include "audiophash.h"
-
-
-uint32_t *ph_audiohash(float *buf, int N, int sr, int &nb_frames) {
-    int frame_length = 4096;  // 2^12
-    int nfft = frame_length;
-    int nfft_half = 2048;
-    int start = 0;
-    int end = start + frame_length - 1;
-    int overlap = (int)(31 * frame_length / 32);
-    int advance = frame_length - overlap;
-    int index = 0;
-    nb_frames = (int)(floor(N / advance) - floor(frame_length / advance) + 1);
-    double window[frame_length];
+#include <memory>
+#include <vector>
+
+/* weights below this are treated as zero when building the sparse bark filterbank */
+#define PH_BARK_MIN_WEIGHT 1e-4
+
+/* /brief everything ph_audiohash needs that only depends on the sample rate and frame length:
+ * the real FFT plan, the hamming window and the bark filterbank. Created once per thread and
+ * kept until the sample rate or frame length changes, so hashing a frame does not allocate.
+ * The filterbank is stored sparsely: each filter only keeps the contiguous run of bins whose
+ * weight is not negligible, and all the runs are packed one after the other in weights.
+ */
+struct ph_audiohash_plan {
+    int sr;
+    int nfft;
+    kiss_fftr_cfg cfg;
+    std::vector<float> window;
+
+    int nfilts;
+    int nbins;                      // number of fft bins any filter uses
+    std::vector<int> filt_start;    // first bin of each filter
+    std::vector<int> filt_length;   // number of bins of each filter
+    std::vector<int> filt_offset;   // offset of each filter's first weight in weights
+    std::vector<float> weights;
+
+    ph_audiohash_plan(int sample_rate, int frame_length);
+    ~ph_audiohash_plan() { free(cfg); }
+};
+
+ph_audiohash_plan::ph_audiohash_plan(int sample_rate, int frame_length)
+    : sr(sample_rate),
+      nfft(frame_length),
+      cfg(kiss_fftr_alloc(frame_length, 0, NULL, NULL)),
+      window(frame_length),
+      nfilts(PH_AUDIOHASH_FILTERS),
+      nbins(0) {
     for (int i = 0; i < frame_length; i++) {
         // hamming window
         window[i] = 0.54 - 0.46 * cos(2 * M_PI * i / (frame_length - 1));
     }
 
-    double frame[frame_length];
-    complex<double> *pF = new complex<double>[nfft];
-
-    double magnF[nfft_half];
-    double maxF = 0.0;
-    double maxB = 0.0;
-
+    int nfft_half = frame_length / 2;
     double minfreq = 300;
     double maxfreq = 3000;
     double minbark = 6 * asinh(minfreq / 600.0);
     double maxbark = 6 * asinh(maxfreq / 600.0);
     double nyqbark = maxbark - minbark;
-    int nfilts = 33;
     double stepbarks = nyqbark / (nfilts - 1);
     int nb_barks = (int)(floor(nfft_half / 2 + 1));
     double barkwidth = 1.06;
 
-    double freqs[nb_barks];
-    double binbarks[nb_barks];
-    double curr_bark[nfilts];
-    double prev_bark[nfilts];
-    for (int i = 0; i < nfilts; i++) {
-        prev_bark[i] = 0.0;
-    }
-    uint32_t *hash = (uint32_t *)malloc(nb_frames * sizeof(uint32_t));
-    double lof, hif;
-
+    std::vector<double> binbarks(nb_barks);
     for (int i = 0; i < nb_barks; i++) {
         binbarks[i] = 6 * asinh(i * sr / nfft_half / 600.0);
-        freqs[i] = i * sr / nfft_half;
-    }
-    double **wts = new double *[nfilts];
-    for (int i = 0; i < nfilts; i++) {
-        wts[i] = new double[nfft_half];
-    }
-    for (int i = 0; i < nfilts; i++) {
-        for (int j = 0; j < nfft_half; j++) {
-            wts[i][j] = 0.0;
-        }
     }
 
-    // calculate wts for each filter
+    // calculate wts for each filter, keeping only the bins between the first and last non-negligible weight
+    std::vector<double> wts(nb_barks);
     for (int i = 0; i < nfilts; i++) {
         double f_bark_mid = minbark + i * stepbarks;
+        int first = -1;
+        int last = -1;
         for (int j = 0; j < nb_barks; j++) {
             double barkdiff = binbarks[j] - f_bark_mid;
-            lof = -2.5 * (barkdiff / barkwidth - 0.5);
-            hif = barkdiff / barkwidth + 0.5;
+            double lof = -2.5 * (barkdiff / barkwidth - 0.5);
+            double hif = barkdiff / barkwidth + 0.5;
             double m = std::min(lof, hif);
             m = std::min(0.0, m);
-            m = pow(10, m);
-            wts[i][j] = m;
+            wts[j] = pow(10, m);
+            if (wts[j] >= PH_BARK_MIN_WEIGHT) {
+                if (first == -1) first = j;
+                last = j;
+            }
+        }
+        if (first == -1) {
+            first = last = 0;
         }
+        filt_start.push_back(first);
+        filt_length.push_back(last - first + 1);
+        filt_offset.push_back(weights.size());
+        weights.insert(weights.end(), wts.begin() + first, wts.begin() + last + 1);
+        nbins = std::max(nbins, last + 1);
     }
+}
 
-    // p = fftw_plan_dft_r2c_1d(frame_length,frame,pF,FFTW_ESTIMATE);
+static const ph_audiohash_plan *ph_get_audiohash_plan(int sr, int frame_length) {
+    thread_local std::unique_ptr<ph_audiohash_plan> plan;
+    if (!plan || plan->sr != sr || plan->nfft != frame_length) {
+        plan.reset(new ph_audiohash_plan(sr, frame_length));
+    }
+    return plan->cfg ? plan.get() : NULL;
+}
 
-    while (end < N) {
-        maxF = 0.0;
-        maxB = 0.0;
-        for (int i = 0; i < frame_length; i++) {
-            frame[i] = window[i] * buf[start + i];
-        }
-        // fftw_execute(p);
-        if (fft(frame, frame_length, pF) < 0) {
-            return NULL;
-        }
-        for (int i = 0; i < nfft_half; i++) {
-            // magnF[i] = sqrt(pF[i][0]*pF[i][0] +  pF[i][1]*pF[i][1] );
-            magnF[i] = abs(pF[i]);
-            if (magnF[i] > maxF) {
-                maxF = magnF[i];
-            }
-        }
 
-        for (int i = 0; i < nfilts; i++) {
-            curr_bark[i] = 0;
-            for (int j = 0; j < nfft_half; j++) {
-                curr_bark[i] += wts[i][j] * magnF[j];
-            }
-            if (curr_bark[i] > maxB) maxB = curr_bark[i];
-        }
+uint32_t ph_audiohash_frame(const float *buf, int sr, double *prev_bark) {
+    const int frame_length = PH_AUDIOHASH_FRAME_LENGTH;
+    const int nfft_half = frame_length / 2;
+    const int nfilts = PH_AUDIOHASH_FILTERS;
 
-        uint32_t curr_hash = 0x00000000u;
-        for (int m = 0; m < nfilts - 1; m++) {
-            double H = curr_bark[m] - curr_bark[m + 1] -
-                       (prev_bark[m] - prev_bark[m + 1]);
-            curr_hash = curr_hash << 1;
-            if (H > 0) curr_hash |= 0x00000001;
-        }
+    const ph_audiohash_plan *plan = ph_get_audiohash_plan(sr, frame_length);
+    if (!plan) {
+        return 0;
+    }
 
-        hash[index] = curr_hash;
-        for (int i = 0; i < nfilts; i++) {
-            prev_bark[i] = curr_bark[i];
+    kiss_fft_scalar frame[frame_length];
+    kiss_fft_cpx pF[nfft_half + 1];
+    float magnF[nfft_half];
+    double curr_bark[nfilts];
+
+    for (int i = 0; i < frame_length; i++) {
+        frame[i] = plan->window[i] * buf[i];
+    }
+    // fftw_execute(p);
+    kiss_fftr(plan->cfg, frame, pF);
+    // only the bins the filterbank uses are needed
+    for (int i = 0; i < plan->nbins; i++) {
+        magnF[i] = sqrt(pF[i].r * pF[i].r + pF[i].i * pF[i].i);
+    }
+
+    for (int i = 0; i < nfilts; i++) {
+        const float *w = &plan->weights[plan->filt_offset[i]];
+        const float *mag = &magnF[plan->filt_start[i]];
+        float sum = 0.0f;
+        for (int j = 0; j < plan->filt_length[i]; j++) {
+            sum += w[j] * mag[j];
         }
+        curr_bark[i] = sum;
+    }
+
+    uint32_t curr_hash = 0x00000000u;
+    for (int m = 0; m < nfilts - 1; m++) {
+        double H = curr_bark[m] - curr_bark[m + 1] -
+                   (prev_bark[m] - prev_bark[m + 1]);
+        curr_hash = curr_hash << 1;
+        if (H > 0) curr_hash |= 0x00000001;
+    }
+
+    for (int i = 0; i < nfilts; i++) {
+        prev_bark[i] = curr_bark[i];
+    }
+    return curr_hash;
+}
+
+uint32_t *ph_audiohash(const float *buf, int N, int sr, int &nb_frames) {
+    int frame_length = PH_AUDIOHASH_FRAME_LENGTH;
+    int start = 0;
+    int end = start + frame_length - 1;
+    int advance = PH_AUDIOHASH_ADVANCE;
+    int index = 0;
+    nb_frames = (int)(floor(N / advance) - floor(frame_length / advance) + 1);
+
+    if (!ph_get_audiohash_plan(sr, frame_length)) {
+        return NULL;
+    }
+
+    double prev_bark[PH_AUDIOHASH_FILTERS];
+    for (int i = 0; i < PH_AUDIOHASH_FILTERS; i++) {
+        prev_bark[i] = 0.0;
+    }
+    uint32_t *hash = (uint32_t *)malloc(nb_frames * sizeof(uint32_t));
+
+    // p = fftw_plan_dft_r2c_1d(frame_length,frame,pF,FFTW_ESTIMATE);
+
+    while (end < N) {
+        hash[index] = ph_audiohash_frame(buf + start, sr, prev_bark);
         index += 1;
         start += advance;
         end += advance;
     }
 
     // fftw_destroy_plan(p);
-    // fftw_free(pF);
-    delete[] pF;
-    for (int i = 0; i < nfilts; i++) {
-        delete[] wts[i];
-    }
-    delete[] wts;
     return hash;
 }
 
 int ph_bitcount(uint32_t n) {
+#if defined(__GNUC__)
+    return __builtin_popcount(n);
+#else
 // parallel bit count
 #define MASK_01010101 (((uint32_t)(-1)) / 3)
 #define MASK_00110011 (((uint32_t)(-1)) / 5)
@@ -160,94 +209,189 @@ int ph_bitcount(uint32_t n) {
     n = (n & MASK_01010101) + ((n >> 1) & MASK_01010101);
     n = (n & MASK_00110011) + ((n >> 2) & MASK_00110011);
     n = (n & MASK_00001111) + ((n >> 4) & MASK_00001111);
-    return n % 255;
+    return (n * 0x01010101) >> 24;
+#endif
+}
+
+/* hamming distance kernels. Each one counts the differing bits of two runs of
+ * n hash values. ph_hamming_distance picks the fastest one the cpu supports
+ * the first time it is called */
+typedef uint64_t (*ph_hamming_kernel)(const uint32_t *, const uint32_t *, int);
+
+static uint64_t ph_hamming_scalar(const uint32_t *a, const uint32_t *b, int n) {
+    uint64_t bits = 0;
+    for (int i = 0; i < n; i++) {
+        bits += ph_bitcount(a[i] ^ b[i]);
+    }
+    return bits;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PH_HAMMING_X86
+#include <immintrin.h>
+
+__attribute__((target("popcnt"))) static uint64_t ph_hamming_popcnt(
+    const uint32_t *a, const uint32_t *b, int n) {
+    uint64_t bits = 0;
+    int i = 0;
+    for (; i + 2 <= n; i += 2) {
+        uint64_t wa, wb;
+        memcpy(&wa, a + i, sizeof(wa));
+        memcpy(&wb, b + i, sizeof(wb));
+        bits += __builtin_popcountll(wa ^ wb);
+    }
+    for (; i < n; i++) {
+        bits += __builtin_popcount(a[i] ^ b[i]);
+    }
+    return bits;
+}
+
+/* nibble lookup popcount: pshufb counts the bits of each nibble and
+ * sad_epu8 sums the byte counts into four 64 bit lanes */
+__attribute__((target("avx2"))) static uint64_t ph_hamming_avx2(
+    const uint32_t *a, const uint32_t *b, int n) {
+    const __m256i lookup =
+        _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1,
+                         1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_xor_si256(
+            _mm256_loadu_si256((const __m256i *)(a + i)),
+            _mm256_loadu_si256((const __m256i *)(b + i)));
+        __m256i lo = _mm256_and_si256(x, low_mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                      _mm256_shuffle_epi8(lookup, hi));
+        acc = _mm256_add_epi64(acc,
+                               _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+    uint64_t bits = (uint64_t)_mm256_extract_epi64(acc, 0) +
+                    (uint64_t)_mm256_extract_epi64(acc, 1) +
+                    (uint64_t)_mm256_extract_epi64(acc, 2) +
+                    (uint64_t)_mm256_extract_epi64(acc, 3);
+    for (; i < n; i++) {
+        bits += __builtin_popcount(a[i] ^ b[i]);
+    }
+    return bits;
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PH_HAMMING_NEON
+#include <arm_neon.h>
+
+/* vcnt counts the bits of each byte, the pairwise adds widen the counts into
+ * two 64 bit lanes */
+static uint64_t ph_hamming_neon(const uint32_t *a, const uint32_t *b, int n) {
+    uint64x2_t acc = vdupq_n_u64(0);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint8x16_t x = vreinterpretq_u8_u32(veorq_u32(vld1q_u32(a + i),
+                                                      vld1q_u32(b + i)));
+        acc = vaddq_u64(acc, vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vcntq_u8(x)))));
+    }
+    uint64_t bits = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+    for (; i < n; i++) {
+        bits += ph_bitcount(a[i] ^ b[i]);
+    }
+    return bits;
+}
+#endif
+
+static ph_hamming_kernel ph_choose_hamming_kernel(const char *&name) {
+#if defined(PH_HAMMING_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        name = "avx2";
+        return ph_hamming_avx2;
+    }
+    if (__builtin_cpu_supports("popcnt")) {
+        name = "popcnt";
+        return ph_hamming_popcnt;
+    }
+#elif defined(PH_HAMMING_NEON)
+    name = "neon";
+    return ph_hamming_neon;
+#endif
+    name = "scalar";
+    return ph_hamming_scalar;
+}
+
+struct ph_hamming_choice {
+    const char *name;
+    ph_hamming_kernel kernel;
+    ph_hamming_choice() : name(NULL) {
+        kernel = ph_choose_hamming_kernel(name);
+    }
+};
+
+/* the kernel is picked the first time it is needed rather than during static
+ * initialisation, so it is safe to use from other static initialisers */
+static const ph_hamming_choice &ph_get_hamming() {
+    static const ph_hamming_choice choice;
+    return choice;
 }
 
+uint64_t ph_hamming_distance(const uint32_t *ptr_a, const uint32_t *ptr_b,
+                             const int n) {
+    return ph_get_hamming().kernel(ptr_a, ptr_b, n);
+}
+
+const char *ph_hamming_engine() { return ph_get_hamming().name; }
+
 double ph_compare_blocks(const uint32_t *ptr_blockA, const uint32_t *ptr_blockB,
                          const int block_size) {
-    double result = 0;
-    for (int i = 0; i < block_size; i++) {
-        uint32_t xordhash = ptr_blockA[i] ^ ptr_blockB[i];
-        result += ph_bitcount(xordhash);
-    }
-    result = result / (32 * block_size);
-    return result;
+    return (double)ph_get_hamming().kernel(ptr_blockA, ptr_blockB,
+                                           block_size) /
+           (32.0 * block_size);
 }
+
 double *ph_audio_distance_ber(uint32_t *hash_a, const int Na, uint32_t *hash_b,
                               const int Nb, const float threshold,
                               const int block_size, int &Nc) {
     uint32_t *ptrA, *ptrB;
-    int N1, N2;
+    int N1;
     if (Na <= Nb) {
         ptrA = hash_a;
         ptrB = hash_b;
         Nc = Nb - Na + 1;
         N1 = Na;
-        N2 = Nb;
     } else {
         ptrB = hash_a;
         ptrA = hash_b;
         Nc = Na - Nb + 1;
         N1 = Nb;
-        N2 = Na;
     }
 
     double *pC = new double[Nc];
     if (!pC) return NULL;
-    int k, M, nb_above, nb_below, hash1_index, hash2_index;
-    double sum_above, sum_below, above_factor, below_factor;
 
-    uint32_t *pha, *phb;
-    double *dist = NULL;
+    /* every offset gets the same number of whole blocks (N1 <= N2 - i), the
+     * block bers are folded into the above/below sums as they are computed
+     * so nothing is allocated per offset */
+    const int M = N1 / block_size;
+    const double block_bits = 32.0 * block_size;
+    const ph_hamming_kernel ph_hamming = ph_get_hamming().kernel;
 
     for (int i = 0; i < Nc; i++) {
-        M = (int)floor(std::min(N1, N2 - i) / block_size);
-
-        pha = ptrA;
-        phb = ptrB + i;
-
-        double *tmp_dist = (double *)realloc(dist, M * sizeof(double));
-        if (!tmp_dist) {
-            return NULL;
-        }
-        dist = tmp_dist;
-        dist[0] = ph_compare_blocks(pha, phb, block_size);
-
-        k = 1;
-
-        pha += block_size;
-        phb += block_size;
-
-        hash1_index = block_size;
-        hash2_index = i + block_size;
-
-        while ((hash1_index < N1 - block_size) &&
-               (hash2_index < N2 - block_size)) {
-            dist[k++] = ph_compare_blocks(pha, phb, block_size);
-            hash1_index += block_size;
-            hash2_index += block_size;
-            pha += block_size;
-            phb += block_size;
-        }
-        sum_above = 0;
-        sum_below = 0;
-        nb_above = 0;
-        nb_below = 0;
-        for (int n = 0; n < M; n++) {
-            if (dist[n] <= threshold) {
-                sum_below += 1 - dist[n];
-                nb_below++;
+        const uint32_t *pha = ptrA;
+        const uint32_t *phb = ptrB + i;
+
+        double sum_above = 0;
+        double sum_below = 0;
+        for (int k = 0; k < M; k++) {
+            double dist = ph_hamming(pha, phb, block_size) / block_bits;
+            if (dist <= threshold) {
+                sum_below += 1 - dist;
             } else {
-                sum_above += 1 - dist[n];
-                nb_above++;
+                sum_above += 1 - dist;
             }
+            pha += block_size;
+            phb += block_size;
         }
-        above_factor = sum_above / M;
-        below_factor = sum_below / M;
-        pC[i] = 0.5 * (1 + below_factor - above_factor);
+        pC[i] = M > 0 ? 0.5 * (1 + (sum_below - sum_above) / M) : 0.0;
     }
 
-    free(dist);
     return pC;
 }
 #ifdef HAVE_PTHREAD
@@ -26,6 +26,7 @@
 #define _AUDIO_PHASH_H
 
 #include <limits.h>
+#include <stdint.h>
 #include <math.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -33,7 +34,12 @@
 #include <string.h>
 //#include "pHash.h"
 
-#include "ph_fft.h"
+#include "kiss_fftr.h"
+
+/* frame length, hop between frames and number of bark filters used by the audio hash */
+#define PH_AUDIOHASH_FRAME_LENGTH 4096
+#define PH_AUDIOHASH_ADVANCE (PH_AUDIOHASH_FRAME_LENGTH / 32)
+#define PH_AUDIOHASH_FILTERS 33
 
 /* /brief audio hash calculation
  * purpose: hash calculation for each frame in the buffer.
@@ -49,7 +55,19 @@
  * audiohash buffer returned /return uint32 pointer to audio hash, NULL for
  * error
  */
-uint32_t *ph_audiohash(float *buf, int nbbuf, const int sr, int &nbframes);
+uint32_t *ph_audiohash(const float *buf, int nbbuf, const int sr, int &nbframes);
+
+/* /brief audio hash of a single frame
+ * purpose: the building block of ph_audiohash, for callers that hash a stream
+ *          a frame at a time and keep the state between frames themselves.
+ *
+ * /param buf - pointer to PH_AUDIOHASH_FRAME_LENGTH samples
+ * /param sr  - sample rate on which to base the audiohash
+ * /param prev_bark - (in/out) PH_AUDIOHASH_FILTERS bark values of the previous
+ * frame (all 0.0 for the first frame), updated to this frame's values
+ * /return uint32 hash value of the frame
+ */
+uint32_t ph_audiohash_frame(const float *buf, int sr, double *prev_bark);
 
 /* /brief bit count set bits in 32bit variable
  * /param n
@@ -57,6 +75,24 @@ uint32_t *ph_audiohash(float *buf, int nbbuf, const int sr, int &nbframes);
  */
 int ph_bitcount(uint32_t n);
 
+/* /brief number of differing bits between two runs of hash values
+ * purpose: the hamming distance kernel behind ph_compare_blocks and
+ *          ph_audio_distance_ber. Uses avx2, popcnt or neon when the cpu has
+ *          them, chosen the first time it is called, and a portable bit count
+ *          otherwise.
+ * /param ptr_a - pointer to the first run
+ * /param ptr_b - pointer to the second run
+ * /param n     - number of uint32 values in each run
+ * /return uint64 number of bits that differ
+ */
+uint64_t ph_hamming_distance(const uint32_t *ptr_a, const uint32_t *ptr_b,
+                             const int n);
+
+/* /brief name of the hamming distance kernel in use ("avx2", "popcnt",
+ * "neon" or "scalar")
+ */
+const char *ph_hamming_engine();
+
 /* /brief compare 2 hash blocks
  * /param ptr_blockA - pointer to the first block
  * /param ptr_blockB - pointer to the second block
@@ -4,6 +4,9 @@
 #include <thread>
 #include <atomic>
 #include <functional>
+#include <vector>
+#include <string>
+#include "latencyhistogram.h"
 
 
 namespace Agentpp
@@ -19,7 +22,9 @@ namespace Snmp_pp
     class SnmpSyntax;
 };
 
-extern bool g_bRun;
+extern std::atomic<bool> g_bRun;  ///< cleared to stop every thread. Atomic as the signal handler, the sources and the pipeline all read or clear it
+
+struct recorderHealth;
 
 class AgentThread
 {
@@ -27,29 +32,57 @@ class AgentThread
         AgentThread(int nPort, int nPortTrap,const std::string& sBaseOid, const std::string& sCommunity="public");
         ~AgentThread();
 
-        void Init(std::function<bool(Snmp_pp::SnmpSyntax*, int)> maskCallback, std::function<bool(Snmp_pp::SnmpSyntax*, int)> activateCallback, unsigned int nMaskLevel);
+        /** nPairs is the number of leg pairs being monitored. Each gets a row in the pair table (base_oid.3.column.pair, pairs numbered from 1).
+        *   The original base_oid.1 values follow the first pair.
+        *   vStages names the analysis stages whose latency is published in the statistics table (base_oid.4.column.stage, stages numbered from 1)
+        **/
+        void Init(std::function<bool(Snmp_pp::SnmpSyntax*, int)> maskCallback, std::function<bool(Snmp_pp::SnmpSyntax*, int)> activateCallback, unsigned int nMaskLevel, size_t nPairs=1,
+                  const std::vector<std::string>& vStages = {});
         void Run();
 
         void AddTrapDestination(const std::string& sIpAddress);
         void RemoveTrapDestination(const std::string& sIpAddress);
 
-        void AudioChanged(int nState);
-        void ComparisonChanged(bool bSame);
-        void DelayChanged(std::chrono::milliseconds delay);
+        void AudioChanged(int nState, size_t nPair);
+        void ComparisonChanged(bool bSame, size_t nPair);
+        void DelayChanged(std::chrono::milliseconds delay, size_t nPair);
+
+        /** Updates the sub-sample delay (microseconds) and the quality (0-100) of the correlation peak it came from.
+        *   These change with every measurement so they are there to be polled and no trap is sent
+        **/
+        void PreciseDelayChanged(std::chrono::microseconds delay, int nQuality, size_t nPair);
         void OverallChanged(bool bActive);
-        void SilenceChanged(bool bSilent, int nLeg);
+        void SilenceChanged(bool bSilent, int nLeg, size_t nPair);
+
+        /** Updates the statistics table row of stage nStage. Polled only - no trap is sent **/
+        void LatencyChanged(size_t nStage, const latencySummary& summary);
+
+        /** Updates the recorder health values (base_oid.5) and the capture columns of a pair's row. Polled only - no trap is sent **/
+        void RecorderHealthChanged(const recorderHealth& health);
+        void PairHealthChanged(size_t nPair, uint64_t nDroppedFrames, unsigned int nHighWater);
+
+        /** Updates the name of the spectrum profile a pair's audio matched best, for the FFT diff check. Polled only - no trap is sent **/
+        void ProfileChanged(const std::string& sProfile, size_t nPair);
 
     private:
         void InitTraps();
         void ThreadLoop();
 
         void SendTrap(int nValue, const std::string& sOid);
+        void SendTrap(int nValue, const std::string& sValueOid, const std::string& sTrapOid);
+
+        bool SetEntry(Agentpp::MibWritableTable* pTable, const std::string& sOid, int nValue);
+        void PairValueChanged(const std::string& sOid, size_t nPair, int nValue, bool bTrap);
 
 
         Agentpp::Snmpx* m_pSnmp;
         Agentpp::Mib* m_pMib;
         Agentpp::RequestList* m_pReqList;
         Agentpp::MibWritableTable* m_pTable;
+        Agentpp::MibWritableTable* m_pPairTable = nullptr;
+        Agentpp::MibWritableTable* m_pStatsTable = nullptr;
+        Agentpp::MibWritableTable* m_pHealthTable = nullptr;
+        size_t m_nPairs = 1;
 
         std::mutex m_mutex;
 
@@ -70,4 +103,23 @@ class AgentThread
         static const std::string OID_OVERALL;
         static const std::string OID_SILENCE_A_LEG;
         static const std::string OID_SILENCE_B_LEG;
+        static const std::string OID_DELAY_PRECISE;
+        static const std::string OID_DELAY_QUALITY;
+        static const std::string OID_DROPPED_FRAMES;
+        static const std::string OID_HIGH_WATER;
+        static const std::string OID_PROFILE;
+
+        static const std::string OID_STAGE_NAME;
+        static const std::string OID_STAGE_COUNT;
+        static const std::string OID_STAGE_P50;
+        static const std::string OID_STAGE_P99;
+        static const std::string OID_STAGE_MAX;
+
+        static const std::string OID_CALLBACKS;
+        static const std::string OID_OVERFLOWS;
+        static const std::string OID_UNDERFLOWS;
+        static const std::string OID_SHORT_CALLBACKS;
+        static const std::string OID_CALLBACK_P50;
+        static const std::string OID_CALLBACK_P99;
+        static const std::string OID_CALLBACK_MAX;
 };
@@ -0,0 +1,86 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <chrono>
+#include "audioview.h"
+#include "hash.h"
+#include "correlator.h"
+#include "legpair.h"
+
+struct MonitoredPair;
+
+/** One capture window on its way through the Compi analysis pipeline, together with what each stage has worked out about it.
+*   The capture stage fills in the audio, the offset stage the offset and the parts of each leg to compare, the leg stages the hash words
+*   and the publish stage turns all that into a result. Jobs are recycled once published so the audio buffers keep their capacity.
+**/
+struct AnalysisJob
+{
+    enum enumType {ANALYSE, SILENT, NO_AUDIO};
+    enum {LEGS = 2};
+
+    void Reset(enumType eNewType)
+    {
+        eType = eNewType;
+        window = deinterlacedView();
+        thePeak = {0.0, 0.0};
+        bLocked = false;
+        nLockGeneration = 0;
+        bTone = false;
+        bAligned = false;
+        result = {0, 0.0};
+        delay = delayEstimate();
+        sProfile.clear();
+        for(size_t i = 0; i < LEGS; i++)
+        {
+            range[i] = {0, 0};
+            vHash[i].clear();
+            nFirstFrame[i] = 0;
+        }
+        nLegsPending = 0;
+    }
+
+    /** Called by each leg stage when it has finished with the job **/
+    void LegDone()
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        --nLegsPending;
+        m_cv.notify_all();
+    }
+
+    /** Called by the publish stage to wait for the leg stages **/
+    void WaitForLegs()
+    {
+        std::unique_lock<std::mutex> lck(m_mutex);
+        m_cv.wait(lck, [this]{ return nLegsPending <= 0; });
+    }
+
+    enumType eType = ANALYSE;
+    MonitoredPair* pPair = nullptr;     ///< the pair of legs the window came from
+    std::chrono::steady_clock::time_point tpCaptured;   ///< when the capture stage finished with the window
+
+    std::vector<float> vBufferA;        ///< copy of the A leg window, so the job does not depend on the Recorder's ring buffer
+    std::vector<float> vBufferB;        ///< copy of the B leg window
+    deinterlacedView window;            ///< views of vBufferA and vBufferB carrying their capture positions
+    peak thePeak{0.0, 0.0};
+    size_t nSamplesToHash = 0;
+    bool bLocked = false;
+    unsigned int nLockGeneration = 0;   ///< the pair's lock generation when the window was captured
+
+    bool bTone = false;                 ///< set by the offset stage
+    bool bAligned = false;              ///< set by the offset stage if range holds the parts of each leg to compare
+    hashrange range[LEGS];
+    hashresult result{0, 0.0};
+    delayEstimate delay;                ///< fractional offset and peak quality, set by the offset stage when it uses the streaming correlator
+    std::string sProfile;               ///< spectrum profile that matched best, set by the offset stage for the FFT diff check
+
+    std::vector<uint32_t> vHash[LEGS];  ///< set by the leg stages
+    size_t nFirstFrame[LEGS];           ///< capture position of the frame each leg's hash words start at, set by the leg stages
+    int nLegsPending = 0;
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+};
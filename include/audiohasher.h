@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include "audioview.h"
+
+/** Stateful perceptual hasher for one leg.
+*   Keeps the sliding frame and the previous frame's bark values between calls so that each 128 sample hop of audio is only hashed once,
+*   however many comparison windows it ends up in. The hash words are kept in a rolling history indexed by the capture position of their frame.
+**/
+class AudioHasher
+{
+    public:
+        explicit AudioHasher(int nSampleRate);
+
+        /** Hashes any audio in the view that has not been seen before and drops history from before the start of the view **/
+        void AddAudio(const AudioView& buffer);
+
+        /** Returns the hash words of the frames that lie entirely between the capture positions nStart and nEnd.
+        *   nFirstFrame is set to the capture position of the start of the first of those frames
+        **/
+        std::vector<uint32_t> GetHashes(size_t nStart, size_t nEnd, size_t& nFirstFrame) const;
+
+        void Reset();
+
+    private:
+        void Restart(size_t nPosition);
+
+        int m_nSampleRate;
+        bool m_bStarted = false;
+
+        std::vector<float> m_vSamples;      ///< audio not yet covered by a complete frame
+        size_t m_nSamplesStart = 0;         ///< capture position of m_vSamples[0]
+        size_t m_nNextFrame = 0;            ///< capture position of the start of the next frame to hash
+        std::vector<double> m_vPrevBark;
+
+        std::deque<uint32_t> m_qHashes;
+        size_t m_nHashesStart = 0;          ///< capture position of the frame that m_qHashes.front() was made from
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+class Recorder;
+
+/** Somewhere the Recorder's audio comes from: the sound card, a recording or a generator.
+*   Once started a source delivers interleaved float blocks of Recorder::FRAMES_PER_BUFFER frames with one channel for each leg to Recorder::Callback
+**/
+class AudioSource
+{
+    public:
+        AudioSource(Recorder& recorder, unsigned long nSampleRate, unsigned short nChannels) :
+            m_recorder(recorder),
+            m_nSampleRate(nSampleRate),
+            m_nChannels(nChannels)
+        {
+        }
+
+        virtual ~AudioSource(){}
+
+        /** Gets the source ready to deliver audio at the Recorder's sample rate and channel count **/
+        virtual bool Open()=0;
+
+        virtual bool Start()=0;
+        virtual void Stop()=0;
+
+    protected:
+        Recorder& m_recorder;
+        unsigned long m_nSampleRate;
+        unsigned short m_nChannels;
+};
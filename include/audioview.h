@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+
+/** Non-owning view over a contiguous run of samples.
+*   Used to pass the Recorder's capture windows through the comparison functions without copying them.
+*   The view is only valid while the storage it points at is - for Recorder windows that is until the next call to CreateBuffer or Locked
+**/
+class AudioView
+{
+    public:
+        AudioView() : m_pData(nullptr), m_nSize(0), m_nPosition(0){}
+        AudioView(const float* pData, size_t nSize, size_t nPosition=0) : m_pData(pData), m_nSize(nSize), m_nPosition(nPosition){}
+
+        const float* data() const { return m_pData; }
+        size_t size() const { return m_nSize; }
+        bool empty() const { return m_nSize == 0; }
+
+        /** Capture position of the first sample (a free running sample count). Views of the same capture can be lined up with it **/
+        size_t GetPosition() const { return m_nPosition; }
+
+        const float* begin() const { return m_pData; }
+        const float* end() const { return m_pData+m_nSize; }
+
+        const float& operator[](size_t nIndex) const { return m_pData[nIndex]; }
+
+        /** Returns a view of nCount samples starting nOffset samples in. Clipped to the end of this view **/
+        AudioView SubView(size_t nOffset, size_t nCount) const
+        {
+            if(nOffset >= m_nSize)
+            {
+                return AudioView();
+            }
+            return AudioView(m_pData+nOffset, std::min(nCount, m_nSize-nOffset), m_nPosition+nOffset);
+        }
+
+    private:
+        const float* m_pData;
+        size_t m_nSize;
+        size_t m_nPosition;
+};
+
+using deinterlacedView = std::pair<AudioView, AudioView>;
+
+/** Signed number of samples from capture position nFrom to nTo. Works across the wrap of the free running position counter **/
+inline long PositionDistance(size_t nFrom, size_t nTo)
+{
+    return static_cast<long>(nTo-nFrom);
+}
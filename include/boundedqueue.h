@@ -0,0 +1,94 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+/** Blocking FIFO with a maximum depth, used to connect the stages of the analysis pipeline.
+*   Push waits while the queue is full so a slow stage holds back the ones feeding it rather than letting work pile up.
+*   Once Close has been called Push fails straight away and Pop returns whatever is left before failing, which lets each stage drain and exit in turn.
+**/
+template<typename T>
+class BoundedQueue
+{
+    public:
+        explicit BoundedQueue(size_t nDepth) : m_nDepth(nDepth > 0 ? nDepth : 1){}
+
+        /** Waits for space then adds the item. Returns false if the queue has been closed **/
+        bool Push(T item)
+        {
+            std::unique_lock<std::mutex> lck(m_mutex);
+            m_cvSpace.wait(lck, [this]{ return m_bClosed || m_qItems.size() < m_nDepth; });
+            if(m_bClosed)
+            {
+                return false;
+            }
+            m_qItems.push_back(std::move(item));
+            m_cvItem.notify_one();
+            return true;
+        }
+
+        /** Adds the item only if there is space **/
+        bool TryPush(T item)
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            if(m_bClosed || m_qItems.size() >= m_nDepth)
+            {
+                return false;
+            }
+            m_qItems.push_back(std::move(item));
+            m_cvItem.notify_one();
+            return true;
+        }
+
+        /** Waits for an item. Returns false once the queue has been closed and emptied **/
+        bool Pop(T& item)
+        {
+            std::unique_lock<std::mutex> lck(m_mutex);
+            m_cvItem.wait(lck, [this]{ return m_bClosed || m_qItems.empty() == false; });
+            if(m_qItems.empty())
+            {
+                return false;
+            }
+            item = std::move(m_qItems.front());
+            m_qItems.pop_front();
+            m_cvSpace.notify_one();
+            return true;
+        }
+
+        /** Takes an item only if one is waiting **/
+        bool TryPop(T& item)
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            if(m_qItems.empty())
+            {
+                return false;
+            }
+            item = std::move(m_qItems.front());
+            m_qItems.pop_front();
+            m_cvSpace.notify_one();
+            return true;
+        }
+
+        void Close()
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            m_bClosed = true;
+            m_cvItem.notify_all();
+            m_cvSpace.notify_all();
+        }
+
+        size_t GetSize() const
+        {
+            std::lock_guard<std::mutex> lg(m_mutex);
+            return m_qItems.size();
+        }
+
+    private:
+        size_t m_nDepth;
+        bool m_bClosed = false;
+        std::deque<T> m_qItems;
+        mutable std::mutex m_mutex;
+        std::condition_variable m_cvItem;
+        std::condition_variable m_cvSpace;
+};
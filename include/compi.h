@@ -1,9 +1,15 @@
 #pragma once
 #include <memory>
+#include <vector>
 #include "inimanager.h"
 #include "hash.h"
 #include <atomic>
 #include <chrono>
+#include <thread>
+#include "boundedqueue.h"
+#include "latencyhistogram.h"
+#include "recorder.h"
+#include <array>
 
 
 namespace Snmp_pp
@@ -13,7 +19,12 @@ namespace Snmp_pp
 
 class AgentThread;
 class Recorder;
+class AudioSource;
 class SpectrumCompare;
+class StreamingCorrelator;
+class AudioHasher;
+struct AnalysisJob;
+struct MonitoredPair;
 
 class Compi
 {
@@ -29,18 +40,41 @@ class Compi
 
         void SetupLogging();
         void SetupAgent();
-        void SetupRecorder();
-        void SetupSpectrumComparitor();
+        bool SetupRecorder();
+        void SetupSpectrumComparitor(MonitoredPair& pair);
+        std::unique_ptr<AudioSource> CreateAudioSource();
+        size_t GetPairCount();
         void Loop();
-
-        void HandleNoLock();
-        bool HandleLock(const hashresult& result);
-        void UpdateSNMP(const hashresult& result, bool bJustLocked);
+        void Capture(MonitoredPair& pair, bool bDone);
+
+        using jobQueue = BoundedQueue<std::shared_ptr<AnalysisJob>>;
+
+        void StartPipeline();
+        void StopPipeline();
+        std::shared_ptr<AnalysisJob> GetSpareJob();
+        void OffsetStage(size_t nShard);
+        void LegStage(size_t nQueue);
+        void PublishStage(size_t nShard);
+        void Publish(AnalysisJob& job);
+
+        void HandleNoLock(MonitoredPair& pair);
+        bool HandleLock(MonitoredPair& pair, const hashresult& result);
+        void UpdateSNMP(MonitoredPair& pair, const hashresult& result, bool bJustLocked);
+        void UpdatePreciseDelay(const AnalysisJob& job);
+
+        /** Stages of the analysis pipeline whose latency is measured. Queue is the time a window waits between capture and the offset stage, total from capture to published **/
+        enum enumStage {STAGE_CAPTURE, STAGE_QUEUE, STAGE_OFFSET, STAGE_HASH, STAGE_COMPARE, STAGE_NOTIFY, STAGE_TOTAL, STAGES};
+        static const std::vector<std::string> STAGE_NAMES;
+
+        /** Records the time from tpStart until now against eStage and returns now **/
+        std::chrono::steady_clock::time_point RecordLatency(enumStage eStage, const std::chrono::steady_clock::time_point& tpStart);
+        void ReportLatency();
+        void ReportRecorderHealth();
         void ClearSNMP();
         void LogHeartbeat();
 
         enum enumLeg{A_LEG=0, B_LEG=1};
-        bool CheckSilence(float dPeak, enumLeg eLeg);
+        bool CheckSilence(MonitoredPair& pair, float dPeak, enumLeg eLeg);
 
         iniManager m_iniConfig;
         std::shared_ptr<AgentThread> m_pAgent;
@@ -50,13 +84,10 @@ class Compi
         int m_nStartDelay;
         int m_nMaxDelay;
         int m_nFailures;
-        int m_nFailureCount;
         bool m_bSendOnActiveOnly;
 
         float m_dSilenceThreshold;
         int m_nSilenceHoldoff;
-        int m_nSilent[2];
-        std::chrono::time_point<std::chrono::system_clock> m_tpSilence[2];
         std::chrono::time_point<std::chrono::system_clock> m_tpLogBeat;
         std::chrono::time_point<std::chrono::system_clock> m_tpStart;
 
@@ -66,13 +97,27 @@ class Compi
         enum enumCheck {HASH, MINUS, FFT_DIFF};
         enumCheck m_eCheck;
 
-        bool m_bLocked;
+        size_t m_nTrackRange = 0;   ///< samples either side of the locked delay to search while locked. 0 to always search the whole window
 
         double m_dFFTChangeDown;
         double m_dFFTChangeUp;
         size_t m_nFFTBands;
         double m_dFFTLimits;
 
-        std::unique_ptr<SpectrumCompare> m_pSpectrum = nullptr;
+        std::vector<std::unique_ptr<MonitoredPair>> m_vPairs;
+
+        //one offset and publish queue per set of stage threads, and one queue per leg of each set
+        std::vector<std::unique_ptr<jobQueue>> m_vOffsetQueues;     ///< capture -> offset
+        std::vector<std::unique_ptr<jobQueue>> m_vLegQueues;        ///< offset -> per leg hashing
+        std::vector<std::unique_ptr<jobQueue>> m_vPublishQueues;    ///< offset -> publish, in capture order
+        std::unique_ptr<jobQueue> m_pSpareQueue = nullptr;          ///< publish -> capture, jobs to reuse
+        std::vector<std::unique_ptr<std::thread>> m_vOffsetThreads;
+        std::vector<std::unique_ptr<std::thread>> m_vLegThreads;
+        std::vector<std::unique_ptr<std::thread>> m_vPublishThreads;
+
+        std::array<LatencyHistogram, STAGES> m_aLatency;
+        std::chrono::seconds m_statsInterval{10};                   ///< how often the latency statistics and recorder health are published. 0 to not publish them
+        std::chrono::steady_clock::time_point m_tpStats;
+        recorderHealth m_lastHealth;                                ///< as last published, so new capture problems can be logged
         enum { FORCE_OFF, FOLLOW_ACTIVE,FORCE_ON};
 };
@@ -0,0 +1,155 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include "audioview.h"
+#include "kiss_xcorr.h"
+
+/** Result of a delay search **/
+struct delayEstimate
+{
+    int nOffset = 0;        ///< samples - the correlation bin with the biggest peak
+    double dOffset = 0.0;   ///< samples - the peak position found by fitting a parabola through that bin and its neighbours
+    double dQuality = 0.0;  ///< 0 (no peak) to 1. For GCC-PHAT the parabola's curvature relative to the peak height, which is 1 for a single bin spike
+};
+
+/** Works out the offset between two legs using a GCC-PHAT cross-correlation.
+*   Owns the kiss_fftr plans, frequency domain buffers, Hann window and scratch buffers for one correlation length
+*   so that repeated calls of the same size do not allocate.
+**/
+class Correlator
+{
+    public:
+        explicit Correlator(size_t nSize);
+        ~Correlator();
+
+        Correlator(const Correlator&) = delete;
+        Correlator& operator=(const Correlator&) = delete;
+
+        size_t GetSize() const { return m_nSize; }
+
+        /** Returns the offset in samples of bufferA relative to bufferB. Only the first GetSize() samples of each view are used **/
+        int CalculateOffset(const AudioView& bufferA, const AudioView& bufferB);
+
+        /** As CalculateOffset but also interpolates between the correlation bins to give a fractional offset, and reports how sharp the peak is **/
+        delayEstimate EstimateDelay(const AudioView& bufferA, const AudioView& bufferB);
+
+    private:
+        size_t m_nSize;
+        kiss_xcorr_cfg m_cfg;
+
+        std::vector<float> m_vWindow;
+        std::vector<float> m_vBufferA;
+        std::vector<float> m_vBufferB;
+        std::vector<float> m_vOut;
+};
+
+static const size_t STREAMING_MAX_HOP = 16384;      ///< most new samples between streaming estimates (about 1/3 of a second at 48kHz)
+
+/** Streaming GCC-PHAT delay estimator.
+*   Rather than correlating the whole window on every loop it keeps a running cross-spectrum that is updated block by block
+*   (overlap-save: each block of B is correlated against the part of A that covers every lag of interest) from only the audio
+*   captured since the last call. Older blocks are faded out with an exponential forgetting factor so the estimate follows changes in delay.
+*   The cost per call is therefore proportional to the amount of new audio rather than the size of the delay window.
+*   Blocks are at most STREAMING_MAX_HOP samples, so the estimate is updated at least that often however long the window is. Below that the
+*   block is whatever the FFT has room for once the lags are covered. The forgetting factor is applied per block, so with shorter blocks
+*   the estimate follows a change of delay sooner but averages over less audio.
+*   The FFT has to cover 3 times the maximum lag, so windows of COARSE_TO_FINE_MIN samples or more are not streamed: each call does a
+*   coarse to fine search of the whole window instead (see ::EstimateDelay), which needs far less memory
+**/
+class StreamingCorrelator
+{
+    public:
+        explicit StreamingCorrelator(double dForget=0.5);
+        ~StreamingCorrelator();
+
+        StreamingCorrelator(const StreamingCorrelator&) = delete;
+        StreamingCorrelator& operator=(const StreamingCorrelator&) = delete;
+
+        /** Feeds any audio in the two views that has not been seen before and returns the offset of bufferA relative to bufferB in the same
+        *   form as Correlator::CalculateOffset. Until enough audio has been seen for a first estimate it falls back to a full window correlation.
+        *   The views must carry their capture positions (see AudioView::GetPosition)
+        **/
+        int CalculateOffset(const AudioView& bufferA, const AudioView& bufferB);
+
+        /** As CalculateOffset but returns the fractional offset and peak quality as well **/
+        delayEstimate EstimateDelay(const AudioView& bufferA, const AudioView& bufferB);
+
+        /** The estimate made by the last call to CalculateOffset or EstimateDelay, relative to the views it was given **/
+        const delayEstimate& GetLastEstimate() const { return m_lastEstimate; }
+
+        /** Forget all the audio seen so far **/
+        void Reset();
+
+        bool IsValid() const { return m_bValid; }
+
+        /** Offset in capture time: A[t+offset] lines up with B[t] **/
+        long GetOffset() const { return m_nOffset; }
+
+        /** Fractional offset in capture time **/
+        double GetFractionalOffset() const { return m_dOffset; }
+
+    private:
+        void Configure(size_t nMaxLag);
+        void Release();
+        void Restart(size_t nPosition);
+        void AddAudio(const AudioView& bufferA, const AudioView& bufferB);
+        bool ProcessBlocks();
+        void CalculateCorrelation();
+
+        double m_dForget;
+
+        size_t m_nMaxLag = 0;
+        size_t m_nFFTSize = 0;
+        size_t m_nHop = 0;
+
+        kiss_fftr_cfg m_fft_fwd = nullptr;
+        kiss_fftr_cfg m_fft_bwd = nullptr;
+
+        std::vector<float> m_vHistoryA;
+        std::vector<float> m_vHistoryB;
+        size_t m_nHistoryStart = 0;     ///< capture position of the first sample in the history buffers
+        size_t m_nBlockStart = 0;       ///< capture position of the first B sample of the next block
+
+        std::vector<float> m_vInA;
+        std::vector<float> m_vInB;
+        std::vector<kiss_fft_cpx> m_vSpectrumA;
+        std::vector<kiss_fft_cpx> m_vSpectrumB;
+        std::vector<kiss_fft_cpx> m_vCross;
+        std::vector<float> m_vCorrelation;
+
+        bool m_bStarted = false;
+        bool m_bValid = false;
+        long m_nOffset = 0;
+        double m_dOffset = 0.0;
+        double m_dQuality = 0.0;
+
+        delayEstimate m_lastEstimate;
+};
+
+static const size_t COARSE_DECIMATION = 8;          ///< decimation used for the first pass of a coarse to fine search
+static const size_t COARSE_TO_FINE_MIN = 65536;     ///< windows at least this long are searched coarse to fine
+
+/** Finds the offset between two long windows in two passes. Both legs are decimated by nDecimation (block averages, which is enough of
+*   a low pass to find the peak) and correlated to find roughly where the lag is. A short full rate correlation of the parts of each leg
+*   that line up at that lag then finds it exactly. Costs about 1/nDecimation of a full length correlation, in time and memory
+**/
+extern delayEstimate EstimateDelayCoarseToFine(const AudioView& bufferA, const AudioView& bufferB, size_t nDecimation=COARSE_DECIMATION);
+
+/** Works out the offset of bufferA relative to bufferB with a single full length correlation for short windows and a coarse to fine
+*   search for windows of COARSE_TO_FINE_MIN samples or more
+**/
+extern delayEstimate EstimateDelay(const AudioView& bufferA, const AudioView& bufferB);
+
+/** Looks for the offset of bufferA relative to bufferB only within nRange samples either side of nCentre, with a direct time domain
+*   correlation of (at most) the last TRACK_SAMPLES samples. Used once the legs are locked, when the delay should barely move.
+*   The quality is the normalised correlation coefficient at the peak (0-1). Returns false if there is no clear correlation peak or the peak is at
+*   the edge of the range (the delay has moved further than that)
+**/
+extern bool TrackDelay(const AudioView& bufferA, const AudioView& bufferB, long nCentre, size_t nRange, delayEstimate& estimate);
+
+static const size_t TRACK_SAMPLES = 8192;
+
+/** Returns the calling thread's Correlator for correlations of nSize samples, creating it if needed.
+*   Only a handful of sizes are kept (the window only changes when the Recorder changes its delay window)
+**/
+extern Correlator& GetCorrelator(size_t nSize);
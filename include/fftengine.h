@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include "kiss_fftr.h"
+
+/** Hann windowed real FFT of one fixed size.
+*   Owns the kiss_fftr plan, the window table and the input scratch buffer so that transforming a frame is just the multiply and the FFT.
+*   Not thread safe - use GetFFTEngine to get one for the calling thread.
+**/
+class FFTEngine
+{
+    public:
+        explicit FFTEngine(size_t nSize);
+        ~FFTEngine();
+
+        FFTEngine(const FFTEngine&) = delete;
+        FFTEngine& operator=(const FFTEngine&) = delete;
+
+        size_t GetSize() const { return m_nSize; }      ///< number of real input samples
+        size_t GetBins() const { return m_nSize/2+1; }  ///< number of complex output bins
+
+        /** Applies the Hann window to the first GetSize() samples of pIn and writes GetBins() bins to pOut **/
+        void Transform(const float* pIn, kiss_fft_cpx* pOut);
+
+        const std::vector<kiss_fft_scalar>& GetWindow() const { return m_vWindow; }
+
+    private:
+        size_t m_nSize;
+        kiss_fftr_cfg m_cfg;
+        std::vector<kiss_fft_scalar> m_vWindow;
+        std::vector<kiss_fft_scalar> m_vIn;
+};
+
+/** Returns the calling thread's FFTEngine for transforms of nSize samples, creating it if needed **/
+extern FFTEngine& GetFFTEngine(size_t nSize);
+
+static const float MIN_DB = -300.0;     ///< level given to bins that are silent (or very nearly so) instead of -infinity
+
+/** Converts nBins FFT bins to levels in dB, 20*log10(|bin|*dScale), and writes them to pDb.
+*   Works on the power so there is no square root and uses a polynomial log (accurate to well under 0.001dB) with no branches so the
+*   compiler can vectorise the loop. Levels below dFloor are set to dFloor.
+**/
+extern void MagnitudeToDb(const kiss_fft_cpx* pBins, size_t nBins, float dScale, float* pDb, float dFloor=MIN_DB);
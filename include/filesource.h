@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <vector>
+#include "pacedsource.h"
+
+/** Replays a recording so captured faults can be analysed and the analysis path benchmarked without any audio hardware.
+*   The file can be a WAV file (16, 24 or 32 bit PCM or 32 bit float) or raw interleaved 32 bit float samples. Either way it must have at least
+*   as many channels as the Recorder is monitoring - any extra channels are ignored. Samples are assumed to be little-endian.
+**/
+class FileSource : public PacedSource
+{
+    public:
+        FileSource(Recorder& recorder, const std::string& sPath, unsigned long nSampleRate, unsigned short nChannels, bool bRealTime, bool bLoop);
+        ~FileSource();
+
+        /** Opens the file and checks it matches the sample rate and channels the Recorder has been set up for **/
+        bool Open() override;
+
+    protected:
+        size_t FillBlock(float* pBuffer, size_t nFrames) override;
+
+    private:
+        enum enumFormat {RAW_FLOAT, PCM_16, PCM_24, PCM_32, FLOAT_32};
+
+        bool ReadWavHeader();
+        size_t ReadFrames(float* pBuffer, size_t nFrames);
+        bool Rewind();
+
+        std::string m_sPath;
+        bool m_bLoop;
+
+        std::ifstream m_ifs;
+        enumFormat m_eFormat;
+        unsigned short m_nFileChannels;
+        std::streampos m_nDataStart;
+        unsigned long long m_nDataFrames;   ///< frames in the file
+        unsigned long long m_nReadFrames;   ///< frames read since the file was last rewound
+
+        std::vector<char> m_vRead;          ///< raw bytes of the block being converted
+};
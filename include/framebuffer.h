@@ -0,0 +1,53 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+/** FIFO of samples for one leg kept in a single contiguous block, so that a frame can be handed to an FFT as a plain pointer.
+*   Samples are appended at the back and consumed from the front by moving a read index. The consumed samples are only
+*   reclaimed (by moving what is left down to the start) once they outnumber the unread ones, so the cost is amortised and the
+*   storage settles at about twice the high-water mark. Frames are read with GetData and released with Consume, so consuming
+*   less than a frame gives overlapping frames.
+**/
+class FrameBuffer
+{
+    public:
+        FrameBuffer() : m_nRead(0){}
+
+        void Append(const float* pData, size_t nCount)
+        {
+            Compact();
+            m_vSamples.insert(m_vSamples.end(), pData, pData+nCount);
+        }
+
+        /** Number of unread samples **/
+        size_t GetSize() const { return m_vSamples.size()-m_nRead; }
+        bool IsEmpty() const { return GetSize() == 0; }
+
+        /** Pointer to the oldest unread sample. The following GetSize() samples are contiguous. Invalidated by Append **/
+        const float* GetData() const { return m_vSamples.data()+m_nRead; }
+
+        void Consume(size_t nCount)
+        {
+            m_nRead += std::min(nCount, GetSize());
+        }
+
+        void Clear()
+        {
+            m_vSamples.clear();
+            m_nRead = 0;
+        }
+
+    private:
+        void Compact()
+        {
+            if(m_nRead > 0 && m_nRead >= GetSize())
+            {
+                m_vSamples.erase(m_vSamples.begin(), m_vSamples.begin()+m_nRead);
+                m_nRead = 0;
+            }
+        }
+
+        std::vector<float> m_vSamples;
+        size_t m_nRead;
+};
@@ -1,15 +1,32 @@
-#pragma once
-#include <map>
+#pragma once
+#include <map>
 #include <vector>
-#include <deque>
-
+#include <cstddef>
+#include <cstdint>
+#include "audioview.h"
+
 using hashresult = std::pair<int, double>;
-
-extern hashresult CalculateHash(const std::deque<float>& vBufferA, const std::deque<float>& vBufferB, size_t nSampleSize, bool bLocked);
-
-extern int CalculateOffset(std::vector<float> vBufferA, std::vector<float> vBufferB);
+using hashrange = std::pair<size_t, size_t>;    ///< first and one past last capture position of a run of audio
+
+class StreamingCorrelator;
+
+/** Works out which parts of the two windows line up once they are shifted by nOffset (as returned by CalculateOffset).
+*   Returns false if the aligned parts are shorter than nSampleSize
+**/
+extern bool GetHashRanges(const AudioView& bufferA, const AudioView& bufferB, size_t nSampleSize, int nOffset, hashrange& rangeA, hashrange& rangeB);
+
+/** Each leg's hashes start at the first frame of that leg's grid at or after the start of its range, so the two runs can be out by up to
+*   a hop. Drops hash words from the front of whichever run starts later so that the first frames line up to within half a hop.
+*   nLateA and nLateB are how far each run's first frame starts after the start of its range
+**/
+extern void AlignHashes(std::vector<uint32_t>& vHashA, long nLateA, std::vector<uint32_t>& vHashB, long nLateB);
+
+/** Returns the confidence (0-1) that the two runs of hash words were made from the same audio, or -1 if either is empty **/
+extern double CompareHashes(std::vector<uint32_t> vHashA, std::vector<uint32_t> vHashB);
+
+extern int CalculateOffset(const AudioView& bufferA, const AudioView& bufferB);
 
-extern bool CheckForTone(std::vector<float> vBufferA, std::vector<float> vBufferB);
+extern bool CheckForTone(const AudioView& bufferA, const AudioView& bufferB);
 
 
 extern float HannWindow(float dIn, size_t nSample, size_t nSize);
@@ -21,6 +21,30 @@ enum
     KISS_XCORR,
 };
 
+/*
+ * pre-allocated state for repeated 1D cross-correlations of the same length
+ */
+struct kiss_xcorr_state
+{
+    size_t n;
+    kiss_fftr_cfg fft_fwd;
+    kiss_fftr_cfg fft_bwd;
+    kiss_fft_cpx *X;
+    kiss_fft_cpx *Y;
+    kiss_fft_cpx *Z;
+};
+typedef struct kiss_xcorr_state *kiss_xcorr_cfg;
+
+/*
+ * allocate the FFT configs and frequency domain buffers for cross-correlations of length n. Returns NULL on failure
+ */
+kiss_xcorr_cfg kiss_xcorr_alloc(size_t n);
+
+/*
+ * free a state allocated with kiss_xcorr_alloc
+ */
+void kiss_xcorr_free(kiss_xcorr_cfg cfg);
+
 /*
  * calculate frequency domain length when doing real-fft
  */
@@ -31,6 +55,11 @@ size_t calc_freq_comain_len(const int *dims, int ndims);
  */
 void rfft_xcorr(size_t n, const kiss_fft_scalar *x, const kiss_fft_scalar *y, kiss_fft_scalar *z, int mode);
 
+/*
+ * compute 1D cross-correlation function with pre-allocated state. x, y and z must be cfg->n long
+ */
+void rfft_xcorr_cfg(kiss_xcorr_cfg cfg, const kiss_fft_scalar *x, const kiss_fft_scalar *y, kiss_fft_scalar *z, int mode);
+
 /*
  * compute 2D cross-correlation function with pre-allocated buffer
  */
@@ -0,0 +1,108 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+/** p50, p99 and maximum of the latencies recorded over a period, in microseconds **/
+struct latencySummary
+{
+    uint64_t nCount = 0;    ///< latencies recorded since the histogram was created
+    uint64_t nP50 = 0;
+    uint64_t nP99 = 0;
+    uint64_t nMax = 0;
+};
+
+/** Fixed bucket histogram of how long something took. Buckets are a quarter of an octave wide from 1us up to about a minute, so percentiles are
+*   within 19% of the true value whatever the range of latencies. Record is lock-free and never allocates, so any number of pipeline threads
+*   can record into the same histogram. Collect must only be called from one thread.
+**/
+class LatencyHistogram
+{
+    public:
+        LatencyHistogram()
+        {
+            for(auto& nBucket : m_aBuckets)
+            {
+                nBucket = 0;
+            }
+            m_aCollected.fill(0);
+        }
+
+        void Record(std::chrono::nanoseconds duration)
+        {
+            uint64_t nMicroseconds = duration.count() > 0 ? static_cast<uint64_t>(duration.count())/1000 : 0;
+            m_aBuckets[GetBucket(nMicroseconds)].fetch_add(1, std::memory_order_relaxed);
+
+            uint64_t nMax = m_nMax.load(std::memory_order_relaxed);
+            while(nMicroseconds > nMax && !m_nMax.compare_exchange_weak(nMax, nMicroseconds, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        /** Summarises the latencies recorded since the last call, so a recent spike isn't hidden by hours of normal running.
+        *   Percentiles are the upper edge of the bucket they fall in
+        **/
+        latencySummary Collect()
+        {
+            std::array<uint64_t, BUCKETS> aPeriod;
+            uint64_t nPeriod(0);
+            latencySummary summary;
+            for(size_t i = 0; i < BUCKETS; i++)
+            {
+                uint64_t nTotal = m_aBuckets[i].load(std::memory_order_relaxed);
+                aPeriod[i] = nTotal-m_aCollected[i];
+                m_aCollected[i] = nTotal;
+                nPeriod += aPeriod[i];
+                summary.nCount += nTotal;
+            }
+            summary.nMax = m_nMax.exchange(0, std::memory_order_relaxed);
+
+            if(nPeriod > 0)
+            {
+                summary.nP50 = std::min(GetPercentile(aPeriod, nPeriod, 0.5), summary.nMax);
+                summary.nP99 = std::min(GetPercentile(aPeriod, nPeriod, 0.99), summary.nMax);
+            }
+            return summary;
+        }
+
+    private:
+        enum {STEPS_PER_OCTAVE = 4, OCTAVES = 26, BUCKETS = STEPS_PER_OCTAVE*OCTAVES+1};
+
+        static size_t GetBucket(uint64_t nMicroseconds)
+        {
+            if(nMicroseconds <= 1)
+            {
+                return 0;
+            }
+            size_t nBucket = static_cast<size_t>(std::ceil(std::log2(static_cast<double>(nMicroseconds))*STEPS_PER_OCTAVE));
+            return std::min<size_t>(nBucket, BUCKETS-1);
+        }
+
+        static uint64_t GetUpperEdge(size_t nBucket)
+        {
+            return static_cast<uint64_t>(std::pow(2.0, static_cast<double>(nBucket)/STEPS_PER_OCTAVE));
+        }
+
+        static uint64_t GetPercentile(const std::array<uint64_t, BUCKETS>& aCounts, uint64_t nTotal, double dPercentile)
+        {
+            uint64_t nTarget = static_cast<uint64_t>(std::ceil(dPercentile*nTotal));
+            uint64_t nSoFar(0);
+            for(size_t i = 0; i < BUCKETS; i++)
+            {
+                nSoFar += aCounts[i];
+                if(nSoFar >= nTarget)
+                {
+                    return GetUpperEdge(i);
+                }
+            }
+            return GetUpperEdge(BUCKETS-1);
+        }
+
+        std::array<std::atomic<uint64_t>, BUCKETS> m_aBuckets;
+        std::atomic<uint64_t> m_nMax{0};
+
+        std::array<uint64_t, BUCKETS> m_aCollected;     ///< bucket counts at the last Collect
+};
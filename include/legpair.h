@@ -0,0 +1,91 @@
+#pragma once
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include "ringbuffer.h"
+#include "audioview.h"
+
+using peak = std::pair<float, float>;
+
+/** The captured audio of one pair of legs (two channels of the input) and the window Compi is currently comparing them over.
+*   The Recorder writes each block of input into every LegPair from the audio callback. Compi trims the window out of it once it is full
+*   and tells it when the legs have locked so that the window can be lined up by the delay between them.
+**/
+class LegPair
+{
+    public:
+        LegPair(unsigned long nSampleRate, const std::chrono::milliseconds& startDelay, const std::chrono::milliseconds& maxDelay, const std::chrono::milliseconds& minWindow);
+
+        /** Called from the audio callback. pInterleaved points at this pair's first channel, nStride is the number of channels in the input.
+        *   Returns true if this block filled the window
+        **/
+        bool Write(const float* pInterleaved, size_t nFrameCount, size_t nStride);
+
+        bool BufferFull();
+        void CompiReady();
+
+        /** Trims the captured audio to the current window and returns views of it for each leg.
+        *   The views point straight into the ring buffers and stay valid until the next call to CreateBuffer or Locked
+        **/
+        deinterlacedView CreateBuffer();
+
+        /** As CreateBuffer but copies the window into vBufferA and vBufferB (whose capacity is reused) and returns views of the copies.
+        *   The copy is made while the window is still protected, so the views can be handed to other threads and stay valid whatever the LegPair does next.
+        *   The pipeline needs this rather than views of the ring: a job can be queued behind several others, and the next window is trimmed as soon
+        *   as the callback adds a block. Holding the ring until each job was published would let a slow stage fill the ring and drop input,
+        *   and Locked discards the ring when the window changes size. One copy per window costs far less than the hashing that then reads it
+        **/
+        deinterlacedView CopyBuffer(std::vector<float>& vBufferA, std::vector<float>& vBufferB);
+
+        peak GetPeak();
+
+        size_t GetNumberOfSamplesToHash() const
+        {
+            return m_nSamplesToHash;
+        }
+
+        size_t Locked(bool bLocked, long nOffset);
+
+        std::chrono::milliseconds GetMaxDelay();
+        std::chrono::milliseconds GetExpectedTimeToFillBuffer();
+
+        unsigned int GetMaxSamplesForDelay() const { return m_nMaxSamplesForDelay; }
+        unsigned int GetCurrentSamplesForDelay() const { return m_nSamplesForDelay; }
+
+        /** Frames dropped because Compi had not freed enough of the ring buffers for the block **/
+        uint64_t GetDroppedFrames() const { return m_nDroppedFrames; }
+
+        /** The fullest the ring buffers have been since the last call, as a percentage of their capacity **/
+        unsigned int CollectHighWater();
+
+    private:
+        size_t GetRingCapacity() const;
+        deinterlacedView TrimBuffer();
+
+        unsigned long m_nSampleRate;
+
+        size_t m_nStartSamplesForDelay;
+        std::atomic<size_t> m_nSamplesForDelay;
+        size_t m_nMaxSamplesForDelay;
+
+        unsigned int m_nSamplesToHash;
+
+        RingBuffer<float> m_BufferA;        ///< A leg audio. Written by the audio callback, read by Compi
+        RingBuffer<float> m_BufferB;        ///< B leg audio. Always written in step with m_BufferA so positions match
+
+        bool m_bAdjustDelayWindow;
+
+        std::mutex m_mutexInternal;
+
+        std::atomic<float> m_dPeakA;
+        std::atomic<float> m_dPeakB;
+
+        std::atomic<long> m_nOffset;
+        std::atomic<bool> m_bLocked;
+        std::atomic<bool> m_bReady;
+
+        std::atomic<uint64_t> m_nDroppedFrames{0};
+        std::atomic<size_t> m_nHighWater{0};    ///< most samples held by either ring buffer since CollectHighWater
+};
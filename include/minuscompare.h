@@ -1,6 +1,7 @@
 #pragma once
-#include <deque>
 #include "recorder.h"
 
 
-extern std::pair<int, double> CalculateMinus(const std::deque<float>& bufferA, const std::deque<float>& bufferB, const peak& thePeak, size_t nSampleSize, bool bLocked, const std::pair<int, double>& last);
+class StreamingCorrelator;
+
+extern std::pair<int, double> CalculateMinus(const AudioView& bufferA, const AudioView& bufferB, const peak& thePeak, size_t nSampleSize, bool bLocked, const std::pair<int, double>& last, double& dConfidence, StreamingCorrelator& correlator);
@@ -0,0 +1,38 @@
+#pragma once
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "spectrumcompare.h"
+#include "correlator.h"
+#include "audiohasher.h"
+
+class LegPair;
+
+/** Everything Compi keeps for one pair of legs: where its audio comes from, the engines that compare it and its lock and silence state.
+*   A pair's jobs always go through the same pipeline threads, so apart from bLocked (which the capture stage reads) each member is only used by one thread at a time
+**/
+struct MonitoredPair
+{
+    size_t nIndex = 0;                  ///< also the row of the pair in the SNMP pair table (less one)
+    size_t nShard = 0;                  ///< which set of pipeline threads analyses this pair
+    LegPair* pCapture = nullptr;
+
+    std::unique_ptr<SpectrumCompare> pSpectrum = nullptr;
+    std::unique_ptr<StreamingCorrelator> pCorrelator = nullptr;
+    std::unique_ptr<AudioHasher> pHasherA = nullptr;
+    std::unique_ptr<AudioHasher> pHasherB = nullptr;
+
+    std::atomic<bool> bLocked{false};
+    std::atomic<unsigned int> nLockGeneration{0};   ///< bumped by the publish stage whenever the pair locks or unlocks
+    int nFailureCount = 0;
+    double dMinusConfidence = 0.0;      ///< running confidence of the minus check. Offset stage only
+    bool bAES = false;
+
+    uint64_t nDroppedFrames = 0;        ///< as last published. Capture stage only
+    std::string sProfile;               ///< best matching spectrum profile as last published. Publish stage only
+
+    int nSilent[2] = {-1, -1};          ///< capture stage only
+    std::chrono::time_point<std::chrono::system_clock> tpSilence[2];
+};
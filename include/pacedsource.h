@@ -0,0 +1,36 @@
+#pragma once
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "audiosource.h"
+
+/** A source that makes its own blocks of audio on its own thread rather than being driven by a sound card.
+*   In real time mode blocks are delivered at the rate a sound card would deliver them. Otherwise they are delivered as fast as the analysis
+*   takes them: once a window is full the next block waits until Compi has captured it, so no audio is dropped and a run always gives the same result.
+*   When the source runs out of audio compi is asked to exit once the final window has been captured
+**/
+class PacedSource : public AudioSource
+{
+    public:
+        PacedSource(Recorder& recorder, unsigned long nSampleRate, unsigned short nChannels, bool bRealTime);
+        virtual ~PacedSource();
+
+        bool Start() override;
+        void Stop() override;
+
+    protected:
+        /** Fills pBuffer with nFrames interleaved frames. Returns the number of frames filled - fewer than nFrames when the source has finished **/
+        virtual size_t FillBlock(float* pBuffer, size_t nFrames)=0;
+
+        /** Must be called from the destructor of the derived class so the thread is not left calling FillBlock on a half destroyed object **/
+        void StopThread();
+
+    private:
+        void ThreadLoop();
+        void WaitForCapture();
+
+        bool m_bRealTime;
+        std::atomic<bool> m_bRun;
+        std::unique_ptr<std::thread> m_pThread;
+};
@@ -0,0 +1,32 @@
+#pragma once
+#include "portaudio.h"
+#include <string>
+#include "audiosource.h"
+
+/** Captures the sound card input with PortAudio. The device is chosen either by name or by PortAudio device id **/
+class PortAudioSource : public AudioSource
+{
+    public:
+        PortAudioSource(Recorder& recorder, const std::string& sDeviceName, unsigned long nSampleRate, unsigned short nChannels);
+        PortAudioSource(Recorder& recorder, short nDeviceId, unsigned long nSampleRate, unsigned short nChannels);
+        ~PortAudioSource();
+
+        bool Open() override;
+        bool Start() override;
+        void Stop() override;
+
+    private:
+        short GetDeviceId(const std::string& sName);
+        std::string GetDeviceName(short nDeviceId);
+
+        std::string m_sDeviceName;
+        short m_nDeviceId;
+
+        bool m_bInitialised;
+        PaStream* m_pStream;                ///< pointer to the PaStream tha reads in the audio
+};
+
+
+/** PaStreamCallback function - simply calls Recorder::Callback using userData to get the Recorder object
+**/
+int paCallback( const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void *userData );
@@ -1,96 +1,85 @@
 #pragma once
-#include "portaudio.h"
 #include <string>
-#include <deque>
 #include <chrono>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <vector>
+#include <memory>
+#include "legpair.h"
+#include "latencyhistogram.h"
 
+class AudioSource;
 
-using deinterlacedBuffer = std::pair<std::deque<float>, std::deque<float> >;
-using peak = std::pair<float, float>;
+/** Counts of capture problems since the Recorder started, and how long the audio callback took since the last CollectHealth **/
+struct recorderHealth
+{
+    uint64_t nCallbacks = 0;
+    uint64_t nOverflows = 0;        ///< blocks the input flagged as having lost audio before it was delivered
+    uint64_t nUnderflows = 0;       ///< blocks the input flagged as padded because audio was missing
+    uint64_t nShortCallbacks = 0;   ///< blocks of other than FRAMES_PER_BUFFER frames
+    latencySummary callback;
+};
+
+
+/** Takes the audio from an AudioSource and splits it into pairs of legs. Channels 0 and 1 are the first pair, 2 and 3 the second and so on **/
 class Recorder
 {
     public:
 
-        Recorder(const std::string& sDeviceName, unsigned long nSampleRate, const std::chrono::milliseconds& startDelay, const std::chrono::milliseconds& maxDelay, const std::chrono::milliseconds& minWindow);
-        Recorder(unsigned short nDeviceId, unsigned long nSampleRate, const std::chrono::milliseconds& startDelay, const std::chrono::milliseconds& maxDelay, const std::chrono::milliseconds& minWindow);
+        Recorder(unsigned long nSampleRate, const std::chrono::milliseconds& startDelay, const std::chrono::milliseconds& maxDelay, const std::chrono::milliseconds& minWindow, unsigned short nPairs=1);
+
+        /** Sets where the audio comes from. Must be called before Init. The source is created with this Recorder and GetChannelCount channels **/
+        void SetSource(std::unique_ptr<AudioSource> pSource);
 
         bool Init();
         void Exit();
 
-        void Callback(const float* pBuffer, size_t nFrameCount);
+        /** Status flags an AudioSource can pass to Callback. The values are the same as PortAudio's **/
+        enum enumFlags {INPUT_UNDERFLOW = 0x1, INPUT_OVERFLOW = 0x2};
 
-        std::mutex& GetMutex() { return m_mutex;}
-        std::condition_variable& GetConditionVariable() { return m_cv; }
-
-        bool BufferFull();
-        void CompiReady();
+        void Callback(const float* pBuffer, size_t nFrameCount, unsigned long nFlags=0);
 
-        deinterlacedBuffer CreateBuffer();
-
-        const peak& GetPeak();
+        /** Must only be called from one thread **/
+        recorderHealth CollectHealth();
 
+        std::mutex& GetMutex() { return m_mutex;}
 
+        /** Notified whenever the window of any of the pairs is full **/
+        std::condition_variable& GetConditionVariable() { return m_cv; }
 
-        size_t GetNumberOfSamplesToHash() const
-        {
-            return m_nSamplesToHash;
-        }
+        size_t GetPairCount() const { return m_vPairs.size(); }
+        unsigned short GetChannelCount() const { return m_nChannels; }
+        LegPair& GetPair(size_t nPair) { return *m_vPairs[nPair]; }
 
-        size_t Locked(bool bLocked, long nOffset);
+        /** True if the window of any of the pairs is full **/
+        bool BufferFull();
 
-        std::chrono::milliseconds GetMaxDelay();
+        /** The longest any of the pairs should take to fill its window **/
         std::chrono::milliseconds GetExpectedTimeToFillBuffer();
 
-        unsigned int GetMaxSamplesForDelay() const { return m_nMaxSamplesForDelay; }
-        unsigned int GetCurrentSamplesForDelay() const { return m_nSamplesForDelay; }
+        static const size_t FRAMES_PER_BUFFER = 4096;   ///< frames the input delivers in each call to Callback
 
         ~Recorder();
     private:
 
-        bool InitPortAudio();
-        short GetDeviceId(const std::string& sName);
-        std::string GetDeviceName(short nDeviceId);
-        bool StartRecording();
-
-        std::string m_sDeviceName;
-        short m_nDeviceId;
         unsigned long m_nSampleRate;
         unsigned short m_nChannels;
 
-        size_t m_nStartSamplesForDelay;
-        size_t m_nSamplesForDelay;
-        size_t m_nMaxSamplesForDelay;
-
-        PaStream* m_pStream;                ///< pointer to the PaStream tha reads in the audio
-        bool m_bLoop;
-
         bool m_bInputOk;
 
-        unsigned int m_nSamplesToHash;
+        //updated by the audio callback so atomic rather than locked
+        std::atomic<uint64_t> m_nCallbacks{0};
+        std::atomic<uint64_t> m_nOverflows{0};
+        std::atomic<uint64_t> m_nUnderflows{0};
+        std::atomic<uint64_t> m_nShortCallbacks{0};
+        LatencyHistogram m_callbackDuration;
 
-        size_t m_nTotalSamples;
+        std::vector<std::unique_ptr<LegPair>> m_vPairs;
 
-        deinterlacedBuffer m_Buffer;
-
-        bool m_bAdjustDelayWindow;
+        std::unique_ptr<AudioSource> m_pSource;
 
         std::mutex m_mutex;
-        std::mutex m_mutexInternal;
         std::condition_variable m_cv;
-
-        peak m_peak;
-
-        std::atomic<long> m_nOffset;
-        std::atomic<bool> m_bLocked;
-        std::atomic<bool> m_bReady;
-
-        static const unsigned short CHANNELS =2;
 };
 
-
-/** PaStreamCallback function - simply calls wmComparitor::Callback using userData to get the wmComparitor object
-**/
-int paCallback( const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void *userData );
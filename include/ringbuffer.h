@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+/** Single-producer/single-consumer lock-free ring buffer.
+*   The capacity is rounded up to a power of two so positions can be masked rather than divided. Positions are free running
+*   counters so the difference between the write and read positions is always the number of items available, even after they wrap.
+*   The producer (the audio callback) only ever moves the write position and the consumer (the analysis thread) only ever moves the read position.
+*   Every item is stored twice, once in each half of the storage, so any run of up to GetCapacity() items can be read as one contiguous block with GetData.
+**/
+template<typename T>
+class RingBuffer
+{
+    public:
+        explicit RingBuffer(size_t nMinimumCapacity) :
+            m_nCapacity(NextPowerOfTwo(nMinimumCapacity)),
+            m_nMask(m_nCapacity-1),
+            m_vBuffer(m_nCapacity*2),
+            m_nWrite(0),
+            m_nRead(0)
+        {
+        }
+
+        size_t GetCapacity() const { return m_nCapacity; }
+
+        /** Producer: number of slots that can be written without overwriting unread items **/
+        size_t GetSpace() const
+        {
+            return m_nCapacity - (m_nWrite.load(std::memory_order_relaxed) - m_nRead.load(std::memory_order_acquire));
+        }
+
+        /** Producer: write an item nIndex slots past the write position. It is not visible to the consumer until Commit is called **/
+        void Write(size_t nIndex, const T& value)
+        {
+            size_t nSlot = (m_nWrite.load(std::memory_order_relaxed)+nIndex) & m_nMask;
+            m_vBuffer[nSlot] = value;
+            m_vBuffer[nSlot+m_nCapacity] = value;
+        }
+
+        /** Producer: make nCount written items visible to the consumer **/
+        void Commit(size_t nCount)
+        {
+            m_nWrite.store(m_nWrite.load(std::memory_order_relaxed)+nCount, std::memory_order_release);
+        }
+
+        /** Consumer: number of items available to read **/
+        size_t GetSize() const
+        {
+            return m_nWrite.load(std::memory_order_acquire) - m_nRead.load(std::memory_order_relaxed);
+        }
+
+        size_t GetReadPosition() const { return m_nRead.load(std::memory_order_relaxed); }
+        size_t GetWritePosition() const { return m_nWrite.load(std::memory_order_acquire); }
+
+        /** Consumer: the item nIndex slots past the read position **/
+        const T& operator[](size_t nIndex) const
+        {
+            return m_vBuffer[(m_nRead.load(std::memory_order_relaxed)+nIndex) & m_nMask];
+        }
+
+        /** Consumer: pointer to the item nIndex slots past the read position. The following GetCapacity() items are contiguous **/
+        const T* GetData(size_t nIndex) const
+        {
+            return &m_vBuffer[(m_nRead.load(std::memory_order_relaxed)+nIndex) & m_nMask];
+        }
+
+        /** Consumer: discard nCount items, freeing their slots for the producer **/
+        void Consume(size_t nCount)
+        {
+            m_nRead.store(m_nRead.load(std::memory_order_relaxed)+nCount, std::memory_order_release);
+        }
+
+        /** Consumer: discard everything up to (but not including) the absolute position nPosition **/
+        void ConsumeTo(size_t nPosition)
+        {
+            m_nRead.store(nPosition, std::memory_order_release);
+        }
+
+        static size_t NextPowerOfTwo(size_t nValue)
+        {
+            size_t nPower = 1;
+            while(nPower < nValue)
+            {
+                nPower <<= 1;
+            }
+            return nPower;
+        }
+
+    private:
+        size_t m_nCapacity;
+        size_t m_nMask;
+        std::vector<T> m_vBuffer;
+
+        std::atomic<size_t> m_nWrite;
+        std::atomic<size_t> m_nRead;
+};
@@ -2,31 +2,50 @@
 #include "kiss_fft.h"
 #include "kiss_fftr.h"
 #include "hash.h"
-#include <list>
+#include "framebuffer.h"
 #include <vector>
-#include <deque>
+#include <string>
 
-using nonInterlacedList = std::pair<std::list<float>, std::list<float>>;
+using nonInterlacedFrames = std::pair<FrameBuffer, FrameBuffer>;
 using nonInterlacedVector = std::pair<std::vector<float>, std::vector<float>>;
 using nonInterlacedFFT = std::pair<std::vector<kiss_fft_cpx>, std::vector<kiss_fft_cpx>>;
+using namedSpectrum = std::pair<std::string, std::vector<float>>;
 
 class SpectrumCompare
 {
     public:
-        SpectrumCompare(const std::string& sProfileFile, unsigned long nSampleRate,unsigned long nFramesForGood, unsigned long nFramesForCurrent, double dMaxAllowedLevelDiff, unsigned long nMaxAllowedBandsDiff);
+        SpectrumCompare(const std::string& sProfileFile, unsigned long nSampleRate,unsigned long nFramesForGood, unsigned long nFramesForCurrent, double dMaxAllowedLevelDiff, unsigned long nMaxAllowedBandsDiff, unsigned long nHop=0);
         ~SpectrumCompare();
 
-        hashresult AddAudio(const std::deque<float>& bufferA, const std::deque<float>& bufferB);
+        hashresult AddAudio(const AudioView& bufferA, const AudioView& bufferB);
+
+        /** Switches the current spectrum from a block average (reset every nFramesForCurrent frames) to an exponentially weighted running
+        *   average with a time constant of nTimeConstant frames, compared against the profile every nTimeConstant/4 frames once it has settled.
+        *   Together with overlapping frames (nHop) this lets a fault show up after a few seconds of audio rather than minutes. 0 goes back to block averaging
+        **/
+        void SetRunningAverage(unsigned long nTimeConstant);
+
+        /** Adds every profile in sDirectory to the profiles the current spectrum is compared against, named after its file.
+        *   Each comparison uses whichever profile is closest, so content that changes between programme types doesn't cause false alarms.
+        *   If the library holds any profiles there is no need to learn one before going live
+        **/
+        void LoadProfileLibrary(const std::string& sDirectory);
+
+        /** Name of the profile that matched best at the last comparison **/
+        const std::string& GetProfileName() const;
 
     private:
 
+        bool LoadProfile(const std::string& sPath, std::vector<float>& vSpectrum);
         void LoadProfileFile();
         void SaveProfileFile();
         void ProcessAudio();
         void CalculateChannelOffset();
-        void CalculateSpectrum(std::vector<float>& vSpectrum);
-        void FFT(std::list<float>& buffer, std::vector<kiss_fft_cpx>& vOut);
+        void CalculateSpectrum(std::vector<float>& vSpectrum, double dWeight);
+        void UpdateResult();
+        void FFT(const float* pFrame, std::vector<kiss_fft_cpx>& vOut, std::vector<float>& vLevel);
         unsigned long CompareSpectrums();
+        unsigned long CountBands(const std::vector<float>& vProfile, unsigned long nLimit) const;
 
         void CheckGoLive();
 
@@ -37,11 +56,17 @@ class SpectrumCompare
         unsigned long m_nWindowSamples = 12000;
         unsigned long m_nAccuracy = 192;
         unsigned long m_nSampleRate = 48000;
+        unsigned long m_nFrameSamples = (BINS-1)*2;
+        unsigned long m_nHop = (BINS-1)*2;    ///< samples between the starts of consecutive frames. Less than m_nFrameSamples overlaps them
         double m_dTotalFrames = 0.0;
 
         double m_dFramesForGood = 5000.0;
         double m_dFramesForCurrent = 5000.0;
 
+        double m_dTimeConstant = 0.0;       ///< frames. 0 for block averaging of the current spectrum
+        unsigned long m_nCompareEvery = 0;  ///< frames between comparisons when using a running average
+        unsigned long m_nSinceCompare = 0;
+
 
         bool m_bLive = false;
         double m_dMaxLevel = 3.0;
@@ -51,13 +76,19 @@ class SpectrumCompare
         std::vector<float> m_vSpectrumGood;
         std::vector<float> m_vSpectrumCurrent;
 
+        std::vector<namedSpectrum> m_vProfiles;     ///< the learnt profile (once there is one) followed by the library
+        size_t m_nProfile = 0;                      ///< index of the profile that matched best last time
+
         nonInterlacedFFT m_fftOut;
+        nonInterlacedVector m_vLevel;       ///< level in dB of each bin of m_fftOut
 
-        nonInterlacedList m_Buffer;
+        nonInterlacedFrames m_Buffer;
 
         hashresult m_result;
 
 
 
         static const size_t BINS = 1024;
+        static const size_t BAND_BLOCK = 64;       ///< bins counted between checks against the best match so far
+        static constexpr float MIN_LEVEL = -90.46;    ///< bins quieter than this (0.00003) are left out of the average
 };
@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/** A learnt spectrum profile together with what it was learnt from **/
+struct spectrumProfile
+{
+    unsigned long nSampleRate = 0;      ///< 0 if not known (profiles converted from the old text format)
+    unsigned long nFrames = 0;          ///< number of frames averaged to make the profile, 0 if not known
+    std::vector<float> vSpectrum;       ///< level difference (dB) of each bin
+};
+
+/** Header of the binary profile format. It is followed by nBins native-endian floats. The checksum is the CRC-32 of those floats **/
+struct profileHeader
+{
+    char sMagic[4];
+    uint32_t nVersion;
+    uint32_t nSampleRate;
+    uint32_t nBins;
+    uint64_t nFrames;
+    uint32_t nChecksum;
+    uint32_t nReserved;
+};
+
+static const char PROFILE_MAGIC[4] = {'C','S','P','F'};
+static const uint32_t PROFILE_VERSION = 1;
+
+/** Returns true if the file starts with the binary profile magic number **/
+extern bool IsBinaryProfile(const std::string& sPath);
+
+/** Maps a binary profile file and checks its header, size and checksum before copying the spectrum out **/
+extern bool LoadBinaryProfile(const std::string& sPath, spectrumProfile& profile);
+
+/** Reads the old one value per line text format **/
+extern bool LoadTextProfile(const std::string& sPath, spectrumProfile& profile);
+
+/** Writes a binary profile to a temporary file next to sPath and renames it over sPath, so a crash never leaves a half written profile **/
+extern bool SaveBinaryProfile(const std::string& sPath, const spectrumProfile& profile);
+
+/** Writes the old text format **/
+extern bool SaveTextProfile(const std::string& sPath, const spectrumProfile& profile);
+
+extern uint32_t ProfileChecksum(const float* pData, size_t nCount);
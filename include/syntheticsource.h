@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <random>
+#include "pacedsource.h"
+
+/** How a SyntheticSource makes its audio **/
+struct syntheticSettings
+{
+    enum enumSignal {TONE, NOISE, MUSIC};
+    enum enumDropout {DROP_A, DROP_B, DROP_BOTH};
+
+    enumSignal eSignal = MUSIC;
+    double dFrequency = 1000.0;     ///< tone frequency in Hz
+    double dLevel = -20.0;          ///< peak level in dBFS
+    double dDelay = 20.0;           ///< milliseconds the B leg lags the A leg by. Negative if A lags B
+    double dDelayStep = 0.0;        ///< extra delay in milliseconds added for each pair after the first
+    bool bInvertB = false;          ///< flip the polarity of the B leg
+    double dDropoutEvery = 0.0;     ///< seconds between dropouts. 0 for no dropouts
+    double dDropoutLength = 200.0;  ///< milliseconds each dropout lasts
+    enumDropout eDropout = DROP_B;  ///< which leg(s) drop out
+    unsigned int nSeed = 1;
+    double dDuration = 0.0;         ///< seconds of audio to make before finishing. 0 to run until compi is stopped
+};
+
+/** Generates a test signal for every pair of legs with a known delay between the legs, optional dropouts and polarity flip.
+*   Each pair gets its own signal (from its own seed) so pairs can't be mixed up. With a fixed seed a run always makes the same audio,
+*   so the comparator stack can be stress tested at any sample rate and number of pairs without a sound card
+**/
+class SyntheticSource : public PacedSource
+{
+    public:
+        SyntheticSource(Recorder& recorder, unsigned long nSampleRate, unsigned short nChannels, bool bRealTime, const syntheticSettings& settings);
+        ~SyntheticSource();
+
+        bool Open() override;
+
+        static syntheticSettings::enumSignal GetSignal(const std::string& sSignal);
+        static syntheticSettings::enumDropout GetDropout(const std::string& sLeg);
+
+    protected:
+        size_t FillBlock(float* pBuffer, size_t nFrames) override;
+
+    private:
+        /** The signal of one pair. The A and B legs are read from a history of it at different delays **/
+        struct pairGenerator
+        {
+            std::mt19937 rng;
+            std::vector<float> vHistory;    ///< power of two long so positions can be masked
+            size_t nDelayA = 0;
+            size_t nDelayB = 0;
+            double dPhase = 0.0;
+
+            double dNoteFrequency = 0.0;    ///< 0 for a rest
+            double dNoteLevel = 0.0;
+            size_t nNoteRemaining = 0;      ///< samples until the next note starts
+            size_t nNoteLength = 1;
+        };
+
+        float NextSample(pairGenerator& generator);
+        void NextNote(pairGenerator& generator);
+        bool InDropout() const;
+
+        syntheticSettings m_settings;
+        float m_dAmplitude;
+        std::vector<pairGenerator> m_vGenerators;
+
+        unsigned long long m_nFrame;        ///< frames made so far
+        unsigned long long m_nDuration;     ///< frames to make. 0 for no limit
+        unsigned long long m_nDropoutEvery;
+        unsigned long long m_nDropoutLength;
+};
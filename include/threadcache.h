@@ -0,0 +1,25 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <cstddef>
+
+/** Returns the calling thread's T for nSize, constructing it with T(nSize) the first time that size is asked for.
+*   Used for objects such as FFT plans that are expensive to create and have scratch buffers that can't be shared between threads.
+*   Only nMaxCached sizes are kept - when a new size would go over that the whole cache is cleared, so references handed out earlier
+*   are only valid until the next call for a different size.
+**/
+template<typename T> T& GetThreadCached(size_t nSize, size_t nMaxCached)
+{
+    thread_local std::map<size_t, std::unique_ptr<T>> mCache;
+
+    auto itCached = mCache.find(nSize);
+    if(itCached == mCache.end())
+    {
+        if(mCache.size() >= nMaxCached)
+        {
+            mCache.clear();
+        }
+        itCached = mCache.insert(std::make_pair(nSize, std::unique_ptr<T>(new T(nSize)))).first;
+    }
+    return *(itCached->second);
+}
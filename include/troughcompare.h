@@ -1,5 +1,15 @@
+#pragma once
 #include "hash.h"
 #include <vector>
-#include <deque>
+#include <list>
 
-extern hashresult CalculateFFTDiff(const std::deque<float>& bufferA, const std::deque<float>& bufferB, unsigned int nSampleSize, size_t nBands, double dLimits, double dChangeDown, double dChangeUp);
+/** What CalculateFFTDiff keeps between calls for one pair of legs **/
+struct fftDiffState
+{
+    double dConfidence = 0.0;
+    size_t nMaxBands = 0;
+    size_t nMinBands = 1024;
+    std::list<size_t> lstBands;     ///< number of bands that differed in each of the last 60 calls
+};
+
+extern hashresult CalculateFFTDiff(const AudioView& bufferA, const AudioView& bufferB, unsigned int nSampleSize, size_t nBands, double dLimits, double dChangeDown, double dChangeUp, fftDiffState& state, StreamingCorrelator& correlator);
@@ -0,0 +1,53 @@
+#pragma once
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+/** Small set of threads that stay alive for the life of the program and run short pieces of work (typically one per leg) in parallel.
+*   Run hands all but one of the tasks to the pool and runs the last on the calling thread, so a two leg job only needs one pool thread.
+*   While the caller waits it also picks up queued tasks itself, so Run can safely be used from inside a task.
+**/
+class WorkerPool
+{
+    public:
+        explicit WorkerPool(size_t nThreads);
+        ~WorkerPool();
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        size_t GetThreadCount() const { return m_vThreads.size(); }
+
+        /** Runs every task and returns once they have all finished **/
+        void Run(const std::vector<std::function<void()>>& vTasks);
+
+        /** Runs the two tasks in parallel and returns once both have finished **/
+        void Run(const std::function<void()>& taskA, const std::function<void()>& taskB);
+
+    private:
+        struct batch
+        {
+            size_t nRemaining = 0;
+            std::mutex mutex;
+            std::condition_variable cv;
+        };
+        using task = std::pair<const std::function<void()>*, batch*>;
+
+        void ThreadLoop();
+        bool RunQueued(std::unique_lock<std::mutex>& lck);
+        void Wait(batch& theBatch);
+        static void Execute(const task& theTask);
+
+        std::vector<std::thread> m_vThreads;
+        std::deque<task> m_qTasks;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        bool m_bStop = false;
+};
+
+/** Returns the pool shared by the comparison functions. Created on first use with one thread fewer than the number of cores (minimum 1) **/
+extern WorkerPool& GetWorkerPool();
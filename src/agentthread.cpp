@@ -14,7 +14,10 @@
 #include <sstream>
 #include "log.h"
 #include <iomanip>
+#include <limits>
+#include <algorithm>
 #include "mibwritabletable.h"
+#include "recorder.h"
 
 using namespace Snmp_pp;
 using namespace Agentpp;
@@ -29,8 +32,36 @@ const std::string AgentThread::OID_ACTIVATE = ".5";
 const std::string AgentThread::OID_OVERALL = ".6";
 const std::string AgentThread::OID_SILENCE_A_LEG = ".7";
 const std::string AgentThread::OID_SILENCE_B_LEG = ".8";
+const std::string AgentThread::OID_DELAY_PRECISE = ".9";
+const std::string AgentThread::OID_DELAY_QUALITY = ".10";
+const std::string AgentThread::OID_DROPPED_FRAMES = ".11";
+const std::string AgentThread::OID_HIGH_WATER = ".12";
+const std::string AgentThread::OID_PROFILE = ".13";
+
+const std::string AgentThread::OID_STAGE_NAME = ".1";
+const std::string AgentThread::OID_STAGE_COUNT = ".2";
+const std::string AgentThread::OID_STAGE_P50 = ".3";
+const std::string AgentThread::OID_STAGE_P99 = ".4";
+const std::string AgentThread::OID_STAGE_MAX = ".5";
+
+const std::string AgentThread::OID_CALLBACKS = ".1";
+const std::string AgentThread::OID_OVERFLOWS = ".2";
+const std::string AgentThread::OID_UNDERFLOWS = ".3";
+const std::string AgentThread::OID_SHORT_CALLBACKS = ".4";
+const std::string AgentThread::OID_CALLBACK_P50 = ".5";
+const std::string AgentThread::OID_CALLBACK_P99 = ".6";
+const std::string AgentThread::OID_CALLBACK_MAX = ".7";
+
+namespace
+{
+    //SnmpInt32 so clamp rather than wrap - a count or latency that large is only ever "a lot"
+    int Clamp(uint64_t nValue)
+    {
+        return static_cast<int>(std::min<uint64_t>(nValue, std::numeric_limits<int>::max()));
+    }
+}
 
-bool g_bRun = true;
+std::atomic<bool> g_bRun(true);
 
 AgentThread::AgentThread(int nPort, int nPortTrap, const std::string& sBaseOid, const std::string& sCommunity) :
     m_nPortTrap(nPortTrap),
@@ -84,8 +115,11 @@ AgentThread::~AgentThread()
     Snmp::socket_cleanup();  // Shut down socket subsystem
 }
 
-void AgentThread::Init(std::function<bool(Snmp_pp::SnmpSyntax*, int)> maskCallback, std::function<bool(Snmp_pp::SnmpSyntax*, int)> activateCallback, unsigned int nMaskLevel)
+void AgentThread::Init(std::function<bool(Snmp_pp::SnmpSyntax*, int)> maskCallback, std::function<bool(Snmp_pp::SnmpSyntax*, int)> activateCallback, unsigned int nMaskLevel, size_t nPairs,
+                       const std::vector<std::string>& vStages)
 {
+    m_nPairs = nPairs;
+
     m_pMib->add(new sysGroup("compi SNMP Agent",m_sBaseOid.c_str(), 10));
     m_pMib->add(new snmpGroup());
     m_pMib->add(new snmp_target_mib());
@@ -105,8 +139,54 @@ void AgentThread::Init(std::function<bool(Snmp_pp::SnmpSyntax*, int)> maskCallba
     m_pTable->add(MibWritableEntry(OID_SILENCE_A_LEG.c_str(), SnmpInt32(-1)));  // silence
     m_pTable->add(MibWritableEntry(OID_SILENCE_B_LEG.c_str(), SnmpInt32(-1)));  // silence
 
+    m_pTable->add(MibWritableEntry(OID_DELAY_PRECISE.c_str(), SnmpInt32(0)));  // delay in microseconds
+    m_pTable->add(MibWritableEntry(OID_DELAY_QUALITY.c_str(), SnmpInt32(-1)));  // delay peak quality
+
     m_pMib->add(m_pTable);
 
+    //one row per pair of legs: column.pair
+    m_pPairTable = new MibWritableTable((m_sBaseOid+".3").c_str());
+    for(const auto& sColumn : {OID_AUDIO, OID_COMPARISON, OID_DELAY, OID_SILENCE_A_LEG, OID_SILENCE_B_LEG, OID_DELAY_QUALITY})
+    {
+        for(size_t i = 0; i < m_nPairs; i++)
+        {
+            m_pPairTable->add(MibWritableEntry((sColumn+"."+std::to_string(i+1)).c_str(), SnmpInt32(-1)));
+        }
+    }
+    for(const auto& sColumn : {OID_DELAY_PRECISE, OID_DROPPED_FRAMES, OID_HIGH_WATER})
+    {
+        for(size_t i = 0; i < m_nPairs; i++)
+        {
+            m_pPairTable->add(MibWritableEntry((sColumn+"."+std::to_string(i+1)).c_str(), SnmpInt32(0)));
+        }
+    }
+    for(size_t i = 0; i < m_nPairs; i++)
+    {
+        m_pPairTable->add(MibWritableEntry((OID_PROFILE+"."+std::to_string(i+1)).c_str(), OctetStr("")));
+    }
+    m_pMib->add(m_pPairTable);
+
+    //one row per analysis stage: column.stage. Latencies are in microseconds
+    m_pStatsTable = new MibWritableTable((m_sBaseOid+".4").c_str());
+    for(size_t i = 0; i < vStages.size(); i++)
+    {
+        std::string sRow = "."+std::to_string(i+1);
+        m_pStatsTable->add(MibWritableEntry((OID_STAGE_NAME+sRow).c_str(), OctetStr(vStages[i].c_str())));
+        for(const auto& sColumn : {OID_STAGE_COUNT, OID_STAGE_P50, OID_STAGE_P99, OID_STAGE_MAX})
+        {
+            m_pStatsTable->add(MibWritableEntry((sColumn+sRow).c_str(), SnmpInt32(0)));
+        }
+    }
+    m_pMib->add(m_pStatsTable);
+
+    //capture health of the audio input. Counts are since compi started, callback durations in microseconds
+    m_pHealthTable = new MibWritableTable((m_sBaseOid+".5").c_str());
+    for(const auto& sOid : {OID_CALLBACKS, OID_OVERFLOWS, OID_UNDERFLOWS, OID_SHORT_CALLBACKS, OID_CALLBACK_P50, OID_CALLBACK_P99, OID_CALLBACK_MAX})
+    {
+        m_pHealthTable->add(MibWritableEntry(sOid.c_str(), SnmpInt32(0)));
+    }
+    m_pMib->add(m_pHealthTable);
+
     // load persitent objects from disk
     m_pMib->init();
 
@@ -158,26 +238,10 @@ void AgentThread::ThreadLoop()
 
 }
 
-void AgentThread::AudioChanged(int nState)
+void AgentThread::AudioChanged(int nState, size_t nPair)
 {
-    std::lock_guard<std::mutex> lg(m_mutex);
-
-    MibWritableEntry* pEntry = m_pTable->get(OID_AUDIO.c_str(), true);
-    if(pEntry)
-    {
-        int nCurrent(-1);
-        pEntry->get_value(nCurrent);
-        if(nCurrent != nState)
-        {
-  	        pmlLog(pml::LOG_DEBUG) << "AgentThread\tAudioChanged: " << nState;
-            pEntry->set_value(SnmpInt32(nState));
-            SendTrap(nState, OID_AUDIO);
-        }
-    }
-    else
-    {
-        pmlLog(pml::LOG_WARN)  << "AgentThread\tAudioChanged:  OID Not Found!";
-    }
+    pmlLog(pml::LOG_DEBUG) << "AgentThread\tAudioChanged: " << nPair << "=" << nState;
+    PairValueChanged(OID_AUDIO, nPair, nState, true);
 }
 
 
@@ -204,73 +268,111 @@ void AgentThread::OverallChanged(bool bActive)
 }
 
 
-void AgentThread::ComparisonChanged(bool bSame)
+void AgentThread::ComparisonChanged(bool bSame, size_t nPair)
+{
+    pmlLog(pml::LOG_DEBUG) << "AgentThread\tComparisonChanged: " << nPair << "=" << bSame;
+    PairValueChanged(OID_COMPARISON, nPair, bSame, true);
+}
+
+void AgentThread::SilenceChanged(bool bSilent, int nLeg, size_t nPair)
+{
+    pmlLog(pml::LOG_DEBUG) << "AgentThread\tSilenceChanged: " << nPair << "." << nLeg << "=" << bSilent;
+    PairValueChanged(nLeg==0 ? OID_SILENCE_A_LEG : OID_SILENCE_B_LEG, nPair, bSilent, true);
+}
+
+void AgentThread::DelayChanged(std::chrono::milliseconds delay, size_t nPair)
+{
+    pmlLog(pml::LOG_DEBUG) << "AgentThread\tDelayChanged: " << nPair << "=" << delay.count();
+    PairValueChanged(OID_DELAY, nPair, delay.count(), true);
+}
+
+void AgentThread::PreciseDelayChanged(std::chrono::microseconds delay, int nQuality, size_t nPair)
+{
+    PairValueChanged(OID_DELAY_PRECISE, nPair, delay.count(), false);
+    PairValueChanged(OID_DELAY_QUALITY, nPair, nQuality, false);
+}
+
+void AgentThread::LatencyChanged(size_t nStage, const latencySummary& summary)
 {
     std::lock_guard<std::mutex> lg(m_mutex);
 
-    MibWritableEntry* pEntry = m_pTable->get(OID_COMPARISON.c_str(), true);
-    if(pEntry)
-    {
-        int nCurrent(-1);
-        pEntry->get_value(nCurrent);
-        if(nCurrent != static_cast<int>(bSame))
-        {
-  	        pmlLog(pml::LOG_DEBUG) << "AgentThread\tComparisonChanged: " << bSame;
-            pEntry->set_value(SnmpInt32(bSame));
-            SendTrap(static_cast<int>(bSame), OID_COMPARISON);
-        }
-    }
-    else
-    {
-        pmlLog(pml::LOG_WARN)  << "AgentThread\tComparisonChanged:  OID Not Found!";
-    }
+    std::string sRow = "."+std::to_string(nStage+1);
+    SetEntry(m_pStatsTable, OID_STAGE_COUNT+sRow, Clamp(summary.nCount));
+    SetEntry(m_pStatsTable, OID_STAGE_P50+sRow, Clamp(summary.nP50));
+    SetEntry(m_pStatsTable, OID_STAGE_P99+sRow, Clamp(summary.nP99));
+    SetEntry(m_pStatsTable, OID_STAGE_MAX+sRow, Clamp(summary.nMax));
 }
 
-void AgentThread::SilenceChanged(bool bSilent, int nLeg)
+void AgentThread::RecorderHealthChanged(const recorderHealth& health)
 {
     std::lock_guard<std::mutex> lg(m_mutex);
 
-    std::string sOid = nLeg==0 ? OID_SILENCE_A_LEG : OID_SILENCE_B_LEG;
+    SetEntry(m_pHealthTable, OID_CALLBACKS, Clamp(health.nCallbacks));
+    SetEntry(m_pHealthTable, OID_OVERFLOWS, Clamp(health.nOverflows));
+    SetEntry(m_pHealthTable, OID_UNDERFLOWS, Clamp(health.nUnderflows));
+    SetEntry(m_pHealthTable, OID_SHORT_CALLBACKS, Clamp(health.nShortCallbacks));
+    SetEntry(m_pHealthTable, OID_CALLBACK_P50, Clamp(health.callback.nP50));
+    SetEntry(m_pHealthTable, OID_CALLBACK_P99, Clamp(health.callback.nP99));
+    SetEntry(m_pHealthTable, OID_CALLBACK_MAX, Clamp(health.callback.nMax));
+}
 
-    MibWritableEntry* pEntry = m_pTable->get(sOid.c_str(), true);
-    if(pEntry)
-    {
-        int nCurrent(-1);
-        pEntry->get_value(nCurrent);
-        if(nCurrent != static_cast<int>(bSilent))
-        {
-  	        pmlLog(pml::LOG_DEBUG) << "AgentThread\tSilenceChanged: " << nLeg << "=" << bSilent;
-            pEntry->set_value(SnmpInt32(bSilent));
-            SendTrap(static_cast<int>(bSilent), sOid);
-        }
-    }
-    else
+void AgentThread::PairHealthChanged(size_t nPair, uint64_t nDroppedFrames, unsigned int nHighWater)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+
+    std::string sRow = "."+std::to_string(nPair+1);
+    SetEntry(m_pPairTable, OID_DROPPED_FRAMES+sRow, Clamp(nDroppedFrames));
+    SetEntry(m_pPairTable, OID_HIGH_WATER+sRow, Clamp(nHighWater));
+}
+
+void AgentThread::ProfileChanged(const std::string& sProfile, size_t nPair)
+{
+    std::lock_guard<std::mutex> lg(m_mutex);
+
+    std::string sRow = OID_PROFILE+"."+std::to_string(nPair+1);
+    MibWritableEntry* pEntry = m_pPairTable->get(sRow.c_str(), true);
+    if(!pEntry)
     {
-        pmlLog(pml::LOG_WARN)  << "AgentThread\tSilenceChanged:  OID Not Found!";
+        pmlLog(pml::LOG_WARN)  << "AgentThread\t" << sRow << ":  OID Not Found!";
+        return;
     }
+    pEntry->set_value(OctetStr(sProfile.c_str()));
 }
 
-void AgentThread::DelayChanged(std::chrono::milliseconds delay)
+void AgentThread::PairValueChanged(const std::string& sOid, size_t nPair, int nValue, bool bTrap)
 {
     std::lock_guard<std::mutex> lg(m_mutex);
 
-    MibWritableEntry* pEntry = m_pTable->get(OID_DELAY.c_str(), true);
-    if(pEntry)
+    std::string sRow = sOid+"."+std::to_string(nPair+1);
+    //a single pair system only sends the original traps so that it looks exactly as it did before the pair table
+    if(SetEntry(m_pPairTable, sRow, nValue) && bTrap && m_nPairs > 1)
     {
-        int nCurrent(-1);
-        pEntry->get_value(nCurrent);
-        if(nCurrent != delay.count())
-        {
-  	        pmlLog(pml::LOG_DEBUG) << "AgentThread\tDelayChanged: " << delay.count();
-            pEntry->set_value(SnmpInt32(delay.count()));
-            SendTrap(delay.count(), OID_DELAY);
-        }
+        SendTrap(nValue, m_sBaseOid+".3"+sRow, m_sBaseOid+".2"+sOid);
     }
-    else
+
+    if(nPair == 0 && SetEntry(m_pTable, sOid, nValue) && bTrap)
     {
-        pmlLog(pml::LOG_WARN)  << "AgentThread\tDelayChanged:  OID Not Found!";
+        SendTrap(nValue, sOid);
+    }
+}
+
+bool AgentThread::SetEntry(MibWritableTable* pTable, const std::string& sOid, int nValue)
+{
+    MibWritableEntry* pEntry = pTable->get(sOid.c_str(), true);
+    if(!pEntry)
+    {
+        pmlLog(pml::LOG_WARN)  << "AgentThread\t" << sOid << ":  OID Not Found!";
+        return false;
     }
 
+    int nCurrent(-1);
+    pEntry->get_value(nCurrent);
+    if(nCurrent == nValue)
+    {
+        return false;
+    }
+    pEntry->set_value(SnmpInt32(nValue));
+    return true;
 }
 
 void AgentThread::AddTrapDestination(const std::string& sIpAddress)
@@ -289,11 +391,16 @@ void AgentThread::RemoveTrapDestination(const std::string& sIpAddress)
 
 
 void AgentThread::SendTrap(int nValue, const std::string& sOid)
+{
+    SendTrap(nValue, m_sBaseOid+".1."+sOid, m_sBaseOid+".2."+sOid);
+}
+
+void AgentThread::SendTrap(int nValue, const std::string& sValueOid, const std::string& sTrapOid)
 {
     Vbx* pVbs = new Vbx[1];
-    Oidx rdsOid((m_sBaseOid+".2."+sOid).c_str());
+    Oidx rdsOid(sTrapOid.c_str());
 
-    pVbs[0].set_oid((m_sBaseOid+".1."+sOid).c_str());
+    pVbs[0].set_oid(sValueOid.c_str());
     pVbs[0].set_value(SnmpInt32(nValue));
 
     NotificationOriginator no;
@@ -307,10 +414,9 @@ void AgentThread::SendTrap(int nValue, const std::string& sOid)
         UdpAddress dest(ssDest.str().c_str());
         no.add_v2_trap_destination(dest, "start", "start", m_sCommunity.c_str());
 
-        pmlLog(pml::LOG_DEBUG)  << "AgentThread\tTrap " << sOid << " sent to " << ssDest.str();
+        pmlLog(pml::LOG_DEBUG)  << "AgentThread\tTrap " << sValueOid << " sent to " << ssDest.str();
     }
     no.generate(pVbs, 1, rdsOid, "", "");
 
     delete[] pVbs;
 }
-
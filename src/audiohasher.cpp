@@ -0,0 +1,99 @@
+#include "audiohasher.h"
+#include "audiophash.h"
+#include "log.h"
+
+AudioHasher::AudioHasher(int nSampleRate) :
+    m_nSampleRate(nSampleRate),
+    m_vPrevBark(PH_AUDIOHASH_FILTERS, 0.0)
+{
+    m_vSamples.reserve(PH_AUDIOHASH_FRAME_LENGTH*2);
+}
+
+void AudioHasher::Reset()
+{
+    m_bStarted = false;
+    m_vSamples.clear();
+    m_qHashes.clear();
+    std::fill(m_vPrevBark.begin(), m_vPrevBark.end(), 0.0);
+}
+
+void AudioHasher::Restart(size_t nPosition)
+{
+    Reset();
+    m_bStarted = true;
+    m_nSamplesStart = nPosition;
+    m_nNextFrame = nPosition;
+    m_nHashesStart = nPosition;
+}
+
+void AudioHasher::AddAudio(const AudioView& buffer)
+{
+    size_t nNext = m_nSamplesStart+m_vSamples.size();
+    if(!m_bStarted || PositionDistance(nNext, buffer.GetPosition()) > 0)
+    {   //first time or there is a gap in the audio
+        pmlLog(pml::LOG_DEBUG) << "AudioHasher\tRestart at " << buffer.GetPosition();
+        Restart(buffer.GetPosition());
+        nNext = buffer.GetPosition();
+    }
+
+    //drop hashes that no future window can contain
+    while(m_qHashes.empty() == false && PositionDistance(m_nHashesStart, buffer.GetPosition()) > 0)
+    {
+        m_qHashes.pop_front();
+        m_nHashesStart += PH_AUDIOHASH_ADVANCE;
+    }
+
+    size_t nEnd = buffer.GetPosition()+buffer.size();
+    if(PositionDistance(nNext, nEnd) <= 0)
+    {
+        return;
+    }
+    size_t nFirst = PositionDistance(buffer.GetPosition(), nNext);
+    m_vSamples.insert(m_vSamples.end(), buffer.begin()+nFirst, buffer.end());
+
+    //hash every complete frame
+    size_t nFrame = PositionDistance(m_nSamplesStart, m_nNextFrame);
+    while(nFrame+PH_AUDIOHASH_FRAME_LENGTH <= m_vSamples.size())
+    {
+        if(m_qHashes.empty())
+        {
+            m_nHashesStart = m_nNextFrame;
+        }
+        m_qHashes.push_back(ph_audiohash_frame(m_vSamples.data()+nFrame, m_nSampleRate, m_vPrevBark.data()));
+        m_nNextFrame += PH_AUDIOHASH_ADVANCE;
+        nFrame += PH_AUDIOHASH_ADVANCE;
+    }
+
+    //keep only the audio the next frame needs
+    m_vSamples.erase(m_vSamples.begin(), m_vSamples.begin()+nFrame);
+    m_nSamplesStart += nFrame;
+}
+
+std::vector<uint32_t> AudioHasher::GetHashes(size_t nStart, size_t nEnd, size_t& nFirstFrame) const
+{
+    std::vector<uint32_t> vHashes;
+    if(m_qHashes.empty())
+    {
+        return vHashes;
+    }
+
+    //first frame that starts at or after nStart. This is on this leg's frame grid, so it can be up to a hop later than nStart - AlignHashes
+    //sorts out the difference between the two legs
+    long nFirst = PositionDistance(m_nHashesStart, nStart);
+    nFirst = nFirst <= 0 ? 0 : (nFirst+PH_AUDIOHASH_ADVANCE-1)/PH_AUDIOHASH_ADVANCE;
+    nFirstFrame = m_nHashesStart+nFirst*PH_AUDIOHASH_ADVANCE;
+
+    //last frame that ends at or before nEnd
+    long nLast = PositionDistance(m_nHashesStart, nEnd)-PH_AUDIOHASH_FRAME_LENGTH;
+    if(nLast < 0)
+    {
+        return vHashes;
+    }
+    nLast = std::min(nLast/PH_AUDIOHASH_ADVANCE, static_cast<long>(m_qHashes.size())-1);
+
+    if(nFirst <= nLast)
+    {
+        vHashes.assign(m_qHashes.begin()+nFirst, m_qHashes.begin()+nLast+1);
+    }
+    return vHashes;
+}
@@ -1,6 +1,9 @@
 #include "compi.h"
 #include "agentthread.h"
 #include "recorder.h"
+#include "portaudiosource.h"
+#include "filesource.h"
+#include "syntheticsource.h"
 #include "log.h"
 #include "inisection.h"
 #include "logtofile.h"
@@ -13,6 +16,12 @@
 #include "minuscompare.h"
 #include "troughcompare.h"
 #include "spectrumcompare.h"
+#include "correlator.h"
+#include "audiohasher.h"
+#include "analysisjob.h"
+#include "monitoredpair.h"
+
+const std::vector<std::string> Compi::STAGE_NAMES = {"capture", "queue", "offset", "hash", "compare", "notify", "total"};
 
 Compi::Compi() :
     m_pAgent(nullptr),
@@ -21,16 +30,13 @@ Compi::Compi() :
     m_nStartDelay(100),
     m_nMaxDelay(8000),
     m_nFailures(3),
-    m_nFailureCount(0),
     m_bSendOnActiveOnly(false),
     m_dSilenceThreshold(-70),
     m_nSilenceHoldoff(30),
-    m_nSilent{-1,-1},
     m_tpStart(std::chrono::system_clock::now()),
     m_nMask(FOLLOW_ACTIVE),
     m_bActive(false),
     m_eCheck(HASH),
-    m_bLocked(false),
     m_dFFTChangeDown(0.05),
     m_dFFTChangeUp(0.1),
     m_nFFTBands(20),
@@ -79,19 +85,19 @@ void Compi::SetupAgent()
     }
 
     m_pAgent->Init(std::bind(&Compi::MaskCallback,this,std::placeholders::_1, std::placeholders::_2),
-                   std::bind(&Compi::ActivateCallback,this,std::placeholders::_1, std::placeholders::_2), m_nMask);
+                   std::bind(&Compi::ActivateCallback,this,std::placeholders::_1, std::placeholders::_2), m_nMask, GetPairCount(), STAGE_NAMES);
 
     m_pAgent->Run();
 
 }
 
-void Compi::SetupRecorder()
+bool Compi::SetupRecorder()
 {
-    int nDevice = m_iniConfig.GetIniInt("recorder", "deviceid", -1);
     m_nSampleRate=m_iniConfig.GetIniInt("recorder", "samplerate", 48000);
     m_nStartDelay = m_iniConfig.GetIniInt("delay", "start", 100);
     m_nMaxDelay = m_iniConfig.GetIniInt("delay", "max", 8000);
     m_nFailures = m_iniConfig.GetIniInt("delay", "failures", 3);
+    m_nTrackRange = std::max(0, m_iniConfig.GetIniInt("delay", "track", 2))*m_nSampleRate/1000;
     m_dSilenceThreshold  = std::pow(10, (m_iniConfig.GetIniDouble("silence", "threshold", -70)/20));
     m_nSilenceHoldoff  = m_iniConfig.GetIniInt("silence", "holdoff", 30);
     if(m_iniConfig.GetIniString("method", "check", "hash") == "minus")
@@ -101,77 +107,152 @@ void Compi::SetupRecorder()
     else if(m_iniConfig.GetIniString("method", "check", "hash") == "spectrum")
     {
         m_eCheck = FFT_DIFF;
-        SetupSpectrumComparitor();
     }
 
 
-    if(nDevice != -1)
+    m_pRecorder = std::make_shared<Recorder>(m_nSampleRate, std::chrono::milliseconds(m_nStartDelay), std::chrono::milliseconds(m_nMaxDelay),
+                                             std::chrono::milliseconds(m_iniConfig.GetIniInt("comparison","window",250)), GetPairCount());
+    m_pRecorder->SetSource(CreateAudioSource());
+    if(m_pRecorder->Init() == false)
     {
-        m_pRecorder = std::make_shared<Recorder>(nDevice,m_nSampleRate, std::chrono::milliseconds(m_nStartDelay),
-            std::chrono::milliseconds(m_nMaxDelay), std::chrono::milliseconds(m_iniConfig.GetIniInt("comparison","window",250)));
+        pmlLog(pml::LOG_CRITICAL) << "Compi\tRecorder could not start, exiting";
+        return false;
+    }
 
+    for(size_t i = 0; i < m_pRecorder->GetPairCount(); i++)
+    {
+        std::unique_ptr<MonitoredPair> pPair(new MonitoredPair());
+        pPair->nIndex = i;
+        pPair->pCapture = &m_pRecorder->GetPair(i);
+        pPair->pCorrelator = std::make_unique<StreamingCorrelator>(m_iniConfig.GetIniDouble("delay", "forget", 0.5));
+        pPair->pHasherA = std::make_unique<AudioHasher>(m_nSampleRate);
+        pPair->pHasherB = std::make_unique<AudioHasher>(m_nSampleRate);
+        if(m_eCheck == FFT_DIFF)
+        {
+            SetupSpectrumComparitor(*pPair);
+        }
+        m_vPairs.push_back(std::move(pPair));
     }
-    else
+    return true;
+}
+
+std::unique_ptr<AudioSource> Compi::CreateAudioSource()
+{
+    std::string sSource = m_iniConfig.GetIniString("recorder", "source", "device");
+    bool bRealTime = (m_iniConfig.GetIniInt("recorder", "realtime", 0) == 1);
+
+    if(sSource == "file")
     {
-        m_pRecorder = std::make_shared<Recorder>(m_iniConfig.GetIniString("recorder", "device", "default"),m_nSampleRate, std::chrono::milliseconds(m_nStartDelay),
-        std::chrono::milliseconds(m_nMaxDelay), std::chrono::milliseconds(m_iniConfig.GetIniInt("comparison","window",250)));
+        return std::make_unique<FileSource>(*m_pRecorder, m_iniConfig.GetIniString("recorder", "file", ""), m_nSampleRate, m_pRecorder->GetChannelCount(),
+                                            bRealTime, m_iniConfig.GetIniInt("recorder", "loop", 0) == 1);
+    }
+    else if(sSource == "synthetic")
+    {
+        syntheticSettings settings;
+        settings.eSignal = SyntheticSource::GetSignal(m_iniConfig.GetIniString("synthetic", "signal", "music"));
+        settings.dFrequency = m_iniConfig.GetIniDouble("synthetic", "frequency", 1000.0);
+        settings.dLevel = m_iniConfig.GetIniDouble("synthetic", "level", -20.0);
+        settings.dDelay = m_iniConfig.GetIniDouble("synthetic", "delay", 20.0);
+        settings.dDelayStep = m_iniConfig.GetIniDouble("synthetic", "step", 0.0);
+        settings.bInvertB = (m_iniConfig.GetIniInt("synthetic", "invert", 0) == 1);
+        settings.dDropoutEvery = m_iniConfig.GetIniDouble("synthetic", "dropout", 0.0);
+        settings.dDropoutLength = m_iniConfig.GetIniDouble("synthetic", "dropoutlength", 200.0);
+        settings.eDropout = SyntheticSource::GetDropout(m_iniConfig.GetIniString("synthetic", "dropoutleg", "b"));
+        settings.nSeed = m_iniConfig.GetIniInt("synthetic", "seed", 1);
+        settings.dDuration = m_iniConfig.GetIniDouble("synthetic", "duration", 0.0);
+        return std::make_unique<SyntheticSource>(*m_pRecorder, m_nSampleRate, m_pRecorder->GetChannelCount(), bRealTime, settings);
+    }
 
+    int nDevice = m_iniConfig.GetIniInt("recorder", "deviceid", -1);
+    if(nDevice != -1)
+    {
+        return std::make_unique<PortAudioSource>(*m_pRecorder, static_cast<short>(nDevice), m_nSampleRate, m_pRecorder->GetChannelCount());
     }
-    m_pRecorder->Init();
+    return std::make_unique<PortAudioSource>(*m_pRecorder, m_iniConfig.GetIniString("recorder", "device", "default"), m_nSampleRate, m_pRecorder->GetChannelCount());
+}
 
+size_t Compi::GetPairCount()
+{
+    return std::max(1, m_iniConfig.GetIniInt("recorder", "pairs", 1));
 }
 
-void Compi::SetupSpectrumComparitor()
+void Compi::SetupSpectrumComparitor(MonitoredPair& pair)
 {
-    m_pSpectrum = std::make_unique<SpectrumCompare>(m_iniConfig.GetIniString("Spectrum", "Profile", "/usr/local/etc/profile"),
+    //every pair learns its own profile. The first keeps the configured file name so a single pair system finds the profile it had before
+    std::string sProfile = m_iniConfig.GetIniString("Spectrum", "Profile", "/usr/local/etc/profile");
+    if(pair.nIndex > 0)
+    {
+        sProfile += "."+std::to_string(pair.nIndex+1);
+    }
+
+    pair.pSpectrum = std::make_unique<SpectrumCompare>(sProfile,
                                                     m_nSampleRate, m_iniConfig.GetIniInt("Spectrum", "FramesForGood", 5000), m_iniConfig.GetIniInt("Spectrum", "FramesForCurrent", 5000),
-                                                    m_iniConfig.GetIniDouble("Spectrum", "MaxLevel", 3.0), m_iniConfig.GetIniInt("Spectrum", "MaxBands", 30));
+                                                    m_iniConfig.GetIniDouble("Spectrum", "MaxLevel", 3.0), m_iniConfig.GetIniInt("Spectrum", "MaxBands", 30),
+                                                    m_iniConfig.GetIniInt("Spectrum", "Hop", 0));
+
+    //the ini parser keeps any spaces before an inline comment so trim them off the mode
+    std::string sAveraging = m_iniConfig.GetIniString("Spectrum", "Averaging", "block");
+    if(trim(sAveraging) == "ewma")
+    {
+        pair.pSpectrum->SetRunningAverage(m_iniConfig.GetIniInt("Spectrum", "TimeConstant", 200));
+    }
+
+    std::string sLibrary = m_iniConfig.GetIniString("Spectrum", "Library", "");
+    if(sLibrary.empty() == false)
+    {
+        pair.pSpectrum->LoadProfileLibrary(sLibrary);
+    }
 }
 
-void Compi::HandleNoLock()
+void Compi::HandleNoLock(MonitoredPair& pair)
 {
-    if(m_bLocked)
+    if(pair.bLocked)
     {
 
-        m_nFailureCount++;
-        pmlLog() << "Compi\tNo match for " << m_nFailureCount  << " calculations since last increase of delay";
+        pair.nFailureCount++;
+        pmlLog() << "Compi\tPair " << pair.nIndex+1 << "\tNo match for " << pair.nFailureCount  << " calculations since last increase of delay";
     }
     else
     {   //if we've already lost the lock then don't bother chekcing x times before moving on
-        m_nFailureCount = m_nFailures;
+        pair.nFailureCount = m_nFailures;
     }
 
-    if(m_nFailureCount >= m_nFailures)
+    if(pair.nFailureCount >= m_nFailures)
     {
 
-        if(m_pRecorder->GetCurrentSamplesForDelay() != m_pRecorder->GetMaxSamplesForDelay())
+        if(pair.pCapture->GetCurrentSamplesForDelay() != pair.pCapture->GetMaxSamplesForDelay())
         {
-            size_t nDelay = m_pRecorder->Locked(false, 0);
-            pmlLog() << "Compi\tExceeded max lock failures. Set lock to false and increase window to " << nDelay << "ms";
+            size_t nDelay = pair.pCapture->Locked(false, 0);
+            pmlLog() << "Compi\tPair " << pair.nIndex+1 << "\tExceeded max lock failures. Set lock to false and increase window to " << nDelay << "ms";
         }
         else
         {
-            m_pRecorder->Locked(false, 0);
+            pair.pCapture->Locked(false, 0);
         }
-        m_bLocked = false;
+        if(pair.bLocked)
+        {   //windows already in the pipeline were lined up by the lock we've just lost
+            ++pair.nLockGeneration;
+        }
+        pair.bLocked = false;
 
     }
 }
 
-bool Compi::HandleLock(const hashresult& result)
+bool Compi::HandleLock(MonitoredPair& pair, const hashresult& result)
 {
-    if(m_nFailureCount != 0)
+    if(pair.nFailureCount != 0)
     {
-        pmlLog(pml::LOG_INFO) << "Compi\tRelocked.";
+        pmlLog(pml::LOG_INFO) << "Compi\tPair " << pair.nIndex+1 << "\tRelocked.";
     }
-    m_nFailureCount = 0;
+    pair.nFailureCount = 0;
 
-    if(!m_bLocked)
+    if(!pair.bLocked)
     {
-        size_t nDelay = m_pRecorder->Locked(true, result.first);
+        size_t nDelay = pair.pCapture->Locked(true, result.first);
 
-        pmlLog(pml::LOG_INFO) << "Compi\tLocked. Window: " << nDelay << "ms";
-        m_bLocked = true;
+        pmlLog(pml::LOG_INFO) << "Compi\tPair " << pair.nIndex+1 << "\tLocked. Window: " << nDelay << "ms";
+        pair.bLocked = true;
+        ++pair.nLockGeneration;
 
         return true;
     }
@@ -180,107 +261,409 @@ bool Compi::HandleLock(const hashresult& result)
 
 void Compi::Loop()
 {
-    bool bAES(false);
+    StartPipeline();
+
+    //this thread is the capture stage: it only waits for the recorder, copies the full windows and hands them on so the next windows can be captured straight away
     while(g_bRun)
     {
-        std::unique_lock<std::mutex> lck(m_pRecorder->GetMutex());
+        bool bDone;
+        {
+            std::unique_lock<std::mutex> lck(m_pRecorder->GetMutex());
 
-        //work out how long to wait for before the buffer should be full
-        bool bDone = m_pRecorder->GetConditionVariable().wait_for(lck, m_pRecorder->GetExpectedTimeToFillBuffer(), [this]{return m_pRecorder->BufferFull(); });
+            //work out how long to wait for before the buffer should be full
+            bDone = m_pRecorder->GetConditionVariable().wait_for(lck, m_pRecorder->GetExpectedTimeToFillBuffer(), [this]{return m_pRecorder->BufferFull(); });
+        }
 
         pmlLog(pml::LOG_TRACE) << "MEMORY\t" << GetMemoryUsage();
-        hashresult result{0,0.0};
+
         if(bDone)
         {
-            if(bAES)
-            {
-                pmlLog() << "AES detected";
+            LogHeartbeat();
+        }
 
-                bAES = true;
+        for(auto& pPair : m_vPairs)
+        {
+            if(bDone && pPair->pCapture->BufferFull() == false)
+            {   //this pair's window isn't full yet
+                continue;
             }
+            Capture(*pPair, bDone);
+        }
 
-            LogHeartbeat();
+        if(m_statsInterval.count() > 0 && std::chrono::steady_clock::now()-m_tpStats >= m_statsInterval)
+        {
+            ReportLatency();
+            ReportRecorderHealth();
+        }
+    }
 
-            bool bJustLocked(false);
+    StopPipeline();
+    pmlLog() << "Compi\tExiting....";
+}
 
-            bool bSilentA = CheckSilence(m_pRecorder->GetPeak().first, A_LEG);
-            bool bSilentB = CheckSilence(m_pRecorder->GetPeak().second, B_LEG);
-            if(!bSilentA || !bSilentB)
+void Compi::Capture(MonitoredPair& pair, bool bDone)
+{
+    std::shared_ptr<AnalysisJob> pJob(GetSpareJob());
+    auto tpStart = std::chrono::steady_clock::now();
+    if(bDone)
+    {
+        peak thePeak(pair.pCapture->GetPeak());
+        bool bSilentA = CheckSilence(pair, thePeak.first, A_LEG);
+        bool bSilentB = CheckSilence(pair, thePeak.second, B_LEG);
+        if(!bSilentA || !bSilentB)
+        {
+            pJob->Reset(AnalysisJob::ANALYSE);
+            pJob->thePeak = thePeak;
+            pJob->window = pair.pCapture->CopyBuffer(pJob->vBufferA, pJob->vBufferB);
+            pJob->nSamplesToHash = pair.pCapture->GetNumberOfSamplesToHash();
+            pJob->bLocked = pair.bLocked;
+            pJob->nLockGeneration = pair.nLockGeneration;
+        }
+        else
+        {
+            pair.pCapture->CreateBuffer();    //have to create buffer so that we clear it out
+            pJob->Reset(AnalysisJob::SILENT);
+        }
+    }
+    else
+    {
+        pJob->Reset(AnalysisJob::NO_AUDIO);
+    }
+    pJob->pPair = &pair;
+
+    pair.pCapture->CompiReady();
+    pJob->tpCaptured = RecordLatency(STAGE_CAPTURE, tpStart);
+
+    if(pJob->eType == AnalysisJob::ANALYSE && pJob->window.first.empty())
+    {   //recorder did not have a full window
+        return;
+    }
+    m_vOffsetQueues[pair.nShard]->Push(pJob);
+}
+
+void Compi::StartPipeline()
+{
+    size_t nDepth = std::max(1, m_iniConfig.GetIniInt("pipeline", "depth", 2));
+    m_statsInterval = std::chrono::seconds(std::max(0, m_iniConfig.GetIniInt("pipeline", "stats", 10)));
+    m_tpStats = std::chrono::steady_clock::now();
+
+    //pairs are shared out between sets of stage threads. A pair always uses the same set so its windows are analysed in order
+    size_t nShards = m_iniConfig.GetIniInt("pipeline", "workers", 0);
+    if(nShards == 0)
+    {
+        nShards = std::max(1u, std::thread::hardware_concurrency()/4);
+    }
+    nShards = std::min(nShards, m_vPairs.size());
+
+    pmlLog(pml::LOG_INFO) << "Compi\tStarting analysis pipeline. Queue depth " << nDepth << ". " << nShards << " sets of stage threads for " << m_vPairs.size() << " pairs";
+
+    for(auto& pPair : m_vPairs)
+    {
+        pPair->nShard = pPair->nIndex % nShards;
+    }
+
+    m_pSpareQueue = std::make_unique<jobQueue>(nDepth*5*nShards);   //enough for every job that can be in flight
+    for(size_t i = 0; i < nShards; i++)
+    {
+        m_vOffsetQueues.push_back(std::make_unique<jobQueue>(nDepth));
+        m_vLegQueues.push_back(std::make_unique<jobQueue>(nDepth));
+        m_vLegQueues.push_back(std::make_unique<jobQueue>(nDepth));
+        m_vPublishQueues.push_back(std::make_unique<jobQueue>(nDepth*2));
+    }
+
+    for(size_t i = 0; i < nShards; i++)
+    {
+        m_vPublishThreads.push_back(std::make_unique<std::thread>(&Compi::PublishStage, this, i));
+        m_vLegThreads.push_back(std::make_unique<std::thread>(&Compi::LegStage, this, i*2+A_LEG));
+        m_vLegThreads.push_back(std::make_unique<std::thread>(&Compi::LegStage, this, i*2+B_LEG));
+        m_vOffsetThreads.push_back(std::make_unique<std::thread>(&Compi::OffsetStage, this, i));
+    }
+}
+
+void Compi::StopPipeline()
+{
+    //close each queue once the stages feeding it have finished, so every job already captured is still published
+    for(size_t i = 0; i < m_vOffsetThreads.size(); i++)
+    {
+        m_vOffsetQueues[i]->Close();
+        m_vOffsetThreads[i]->join();
+    }
+
+    for(size_t i = 0; i < m_vLegThreads.size(); i++)
+    {
+        m_vLegQueues[i]->Close();
+        m_vLegThreads[i]->join();
+    }
+
+    for(size_t i = 0; i < m_vPublishThreads.size(); i++)
+    {
+        m_vPublishQueues[i]->Close();
+        m_vPublishThreads[i]->join();
+    }
+
+    m_pSpareQueue->Close();
+}
+
+std::shared_ptr<AnalysisJob> Compi::GetSpareJob()
+{
+    std::shared_ptr<AnalysisJob> pJob;
+    if(m_pSpareQueue->TryPop(pJob) == false)
+    {
+        pJob = std::make_shared<AnalysisJob>();
+    }
+    return pJob;
+}
+
+void Compi::OffsetStage(size_t nShard)
+{
+    std::shared_ptr<AnalysisJob> pJob;
+    while(m_vOffsetQueues[nShard]->Pop(pJob))
+    {
+        MonitoredPair& pair(*pJob->pPair);
+        auto tpStart = RecordLatency(STAGE_QUEUE, pJob->tpCaptured);
+
+        bool bHashLegs(false);
+        if(pJob->eType == AnalysisJob::ANALYSE)
+        {
+            const AudioView& bufferA(pJob->window.first);
+            const AudioView& bufferB(pJob->window.second);
+            switch(m_eCheck)
             {
-                deinterlacedBuffer buffer(m_pRecorder->CreateBuffer());
+                case MINUS:
+                    pJob->result = CalculateMinus(bufferA, bufferB, pJob->thePeak, pJob->nSamplesToHash, pJob->bLocked, pJob->result, pair.dMinusConfidence, *pair.pCorrelator);
+                    pJob->delay = pair.pCorrelator->GetLastEstimate();
+                    break;
+                case FFT_DIFF:
+                    pJob->result = pair.pSpectrum->AddAudio(bufferA, bufferB);
+                    pJob->sProfile = pair.pSpectrum->GetProfileName();
+                    break;
+                default:
+                    bHashLegs = true;
+                    if(CheckForTone(bufferA, bufferB))
+                    {
+                        pmlLog(pml::LOG_DEBUG) << "Compi\tPair " << pair.nIndex+1 << "\tTONE";
+                        pJob->bTone = true;
+                        pJob->result = std::make_pair(0, 1.0);
+                    }
+                    else
+                    {
+                        //once locked the Recorder has already lined the legs up, so only look close to no offset unless the delay has moved away
+                        if(!pJob->bLocked || m_nTrackRange == 0 || !TrackDelay(bufferA, bufferB, 0, m_nTrackRange, pJob->delay))
+                        {
+                            pJob->delay = pair.pCorrelator->EstimateDelay(bufferA, bufferB);
+                        }
+                        pJob->result = std::make_pair(pJob->delay.nOffset, -1.0);
+                        pJob->bAligned = GetHashRanges(bufferA, bufferB, pJob->nSamplesToHash, pJob->result.first, pJob->range[A_LEG], pJob->range[B_LEG]);
+                    }
+            }
+            RecordLatency(STAGE_OFFSET, tpStart);
+        }
+
+        if(bHashLegs)
+        {   //the legs always hash the audio, even for tone, so that their histories stay continuous
+            pJob->nLegsPending = AnalysisJob::LEGS;
+            m_vLegQueues[nShard*2+A_LEG]->Push(pJob);
+            m_vLegQueues[nShard*2+B_LEG]->Push(pJob);
+        }
+        m_vPublishQueues[nShard]->Push(pJob);
+    }
+}
+
+void Compi::LegStage(size_t nQueue)
+{
+    size_t nLeg = nQueue%2;
+
+    std::shared_ptr<AnalysisJob> pJob;
+    while(m_vLegQueues[nQueue]->Pop(pJob))
+    {
+        auto tpStart = std::chrono::steady_clock::now();
+        AudioHasher& hasher(nLeg == A_LEG ? *pJob->pPair->pHasherA : *pJob->pPair->pHasherB);
+        hasher.AddAudio(nLeg == A_LEG ? pJob->window.first : pJob->window.second);
+        if(pJob->bAligned)
+        {
+            pJob->vHash[nLeg] = hasher.GetHashes(pJob->range[nLeg].first, pJob->range[nLeg].second, pJob->nFirstFrame[nLeg]);
+        }
+        RecordLatency(STAGE_HASH, tpStart);
+        pJob->LegDone();
+    }
+}
+
+void Compi::PublishStage(size_t nShard)
+{
+    std::shared_ptr<AnalysisJob> pJob;
+    while(m_vPublishQueues[nShard]->Pop(pJob))
+    {
+        Publish(*pJob);
+        RecordLatency(STAGE_TOTAL, pJob->tpCaptured);
+        m_pSpareQueue->TryPush(pJob);
+    }
+}
+
+void Compi::Publish(AnalysisJob& job)
+{
+    MonitoredPair& pair(*job.pPair);
+
+    switch(job.eType)
+    {
+        case AnalysisJob::ANALYSE:
+            {
+                if(pair.bAES)
+                {
+                    pmlLog() << "AES detected";
 
-                switch(m_eCheck)
+                    pair.bAES = true;
+                }
+
+                if(m_eCheck == HASH)
                 {
-                    case MINUS:
-                        result = CalculateMinus(buffer.first,buffer.second, m_pRecorder->GetPeak(), m_pRecorder->GetNumberOfSamplesToHash(), m_bLocked, result);
-                        break;
-                    case FFT_DIFF:
-                        result = m_pSpectrum->AddAudio(buffer.first, buffer.second);
-                        break;
-                    default:
-                        result = CalculateHash(buffer.first,buffer.second, m_pRecorder->GetNumberOfSamplesToHash(), m_bLocked);
+                    job.WaitForLegs();
+                    if(job.bAligned)
+                    {
+                        auto tpStart = std::chrono::steady_clock::now();
+                        AlignHashes(job.vHash[A_LEG], PositionDistance(job.range[A_LEG].first, job.nFirstFrame[A_LEG]),
+                                    job.vHash[B_LEG], PositionDistance(job.range[B_LEG].first, job.nFirstFrame[B_LEG]));
+                        job.result.second = CompareHashes(std::move(job.vHash[A_LEG]), std::move(job.vHash[B_LEG]));
+                        RecordLatency(STAGE_COMPARE, tpStart);
+                    }
                 }
 
-                pmlLog(pml::LOG_DEBUG) << "Compi\tCalculation\tDelay=" <<  (result.first*1000/m_nSampleRate) << "ms\tConfidence=" << result.second;
-                if(result.second < 0.5) //could not get lock
+                if(m_eCheck == FFT_DIFF && job.sProfile != pair.sProfile)
                 {
-                    HandleNoLock();
+                    pair.sProfile = job.sProfile;
+                    m_pAgent->ProfileChanged(pair.sProfile, pair.nIndex);
+                }
+
+                if(job.nLockGeneration != pair.nLockGeneration)
+                {   //the pair locked or unlocked while this window was in the pipeline, so its offset is relative to an alignment that no longer applies
+                    pmlLog(pml::LOG_DEBUG) << "Compi\tPair " << pair.nIndex+1 << "\tIgnoring a window captured before the lock changed";
+                    break;
+                }
+
+                //the offset is between the views, which the Recorder has already shifted by the locked delay, so add that shift back on
+                hashresult absolute(job.result);
+                absolute.first += PositionDistance(job.window.second.GetPosition(), job.window.first.GetPosition());
+
+                bool bJustLocked(false);
+                auto tpStart = std::chrono::steady_clock::now();
+                pmlLog(pml::LOG_DEBUG) << "Compi\tPair " << pair.nIndex+1 << "\tCalculation\tDelay=" <<  (absolute.first*1000/m_nSampleRate) << "ms\tPrecise=" << (job.delay.dOffset*1000.0/m_nSampleRate)
+                                       << "ms\tQuality=" << job.delay.dQuality << "\tConfidence=" << job.result.second;
+                if(job.result.second < 0.5) //could not get lock
+                {
+                    HandleNoLock(pair);
                 }
                 else
                 {
-                    bJustLocked = HandleLock(result);
+                    bJustLocked = HandleLock(pair, absolute);
+                    UpdatePreciseDelay(job);
                 }
+                UpdateSNMP(pair, absolute, bJustLocked);
+                RecordLatency(STAGE_NOTIFY, tpStart);
             }
-            else
+            break;
+        case AnalysisJob::SILENT:
             {
-                m_pRecorder->CreateBuffer();    //have to create buffer so that we clear it out
-                m_nFailureCount = 0;
-                result = {0,1.0};
-                pmlLog(pml::LOG_TRACE) << "Compi\tBoth channels silent";
-
-
+                pair.nFailureCount = 0;
+                pmlLog(pml::LOG_TRACE) << "Compi\tPair " << pair.nIndex+1 << "\tBoth channels silent";
+                auto tpStart = std::chrono::steady_clock::now();
+                UpdateSNMP(pair, {0,1.0}, false);
+                RecordLatency(STAGE_NOTIFY, tpStart);
             }
-            UpdateSNMP(result, bJustLocked);
-        }
-        else
-        {
-            if(bAES)
+            break;
+        case AnalysisJob::NO_AUDIO:
             {
-                bAES = false;
-                pmlLog(pml::LOG_ERROR) << "Compi\tAES Lost!";;
+                if(pair.bAES)
+                {
+                    pair.bAES = false;
+                    pmlLog(pml::LOG_ERROR) << "Compi\tAES Lost!";;
+                }
+                auto tpStart = std::chrono::steady_clock::now();
+                m_pAgent->AudioChanged(0, pair.nIndex);
+                m_pAgent->ComparisonChanged(-1, pair.nIndex);
+                m_pAgent->DelayChanged(std::chrono::milliseconds(0), pair.nIndex);
+                m_pAgent->SilenceChanged(true, A_LEG, pair.nIndex);  //no AES so it is silent
+                m_pAgent->SilenceChanged(true, B_LEG, pair.nIndex); //no AES so it is silent
+                RecordLatency(STAGE_NOTIFY, tpStart);
             }
-            m_pAgent->AudioChanged(0);
-            m_pAgent->ComparisonChanged(-1);
-            m_pAgent->DelayChanged(std::chrono::milliseconds(0));
-            m_pAgent->SilenceChanged(true, A_LEG);  //no AES so it is silent
-            m_pAgent->SilenceChanged(true, B_LEG); //no AES so it is silent
-        }
+            break;
+    }
+}
 
+std::chrono::steady_clock::time_point Compi::RecordLatency(enumStage eStage, const std::chrono::steady_clock::time_point& tpStart)
+{
+    auto tpNow = std::chrono::steady_clock::now();
+    m_aLatency[eStage].Record(tpNow-tpStart);
+    return tpNow;
+}
 
-        m_pRecorder->CompiReady();
+void Compi::ReportLatency()
+{
+    m_tpStats = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < STAGES; i++)
+    {
+        latencySummary summary = m_aLatency[i].Collect();
+        pmlLog(pml::LOG_DEBUG) << "Compi\tLatency\t" << STAGE_NAMES[i] << "\tCount=" << summary.nCount << "\tp50=" << summary.nP50 << "us\tp99=" << summary.nP99
+                               << "us\tMax=" << summary.nMax << "us";
+        m_pAgent->LatencyChanged(i, summary);
     }
-    pmlLog() << "Compi\tExiting....";
 }
 
-void Compi::UpdateSNMP(const hashresult& result, bool bJustLocked)
+void Compi::ReportRecorderHealth()
+{
+    recorderHealth health = m_pRecorder->CollectHealth();
+    if(health.nOverflows != m_lastHealth.nOverflows || health.nUnderflows != m_lastHealth.nUnderflows || health.nShortCallbacks != m_lastHealth.nShortCallbacks)
+    {
+        pmlLog(pml::LOG_WARN) << "Compi\tCapture problems since last report: Overflows=" << health.nOverflows-m_lastHealth.nOverflows
+                              << "\tUnderflows=" << health.nUnderflows-m_lastHealth.nUnderflows << "\tShort callbacks=" << health.nShortCallbacks-m_lastHealth.nShortCallbacks;
+    }
+    pmlLog(pml::LOG_DEBUG) << "Compi\tRecorder\tCallbacks=" << health.nCallbacks << "\tp50=" << health.callback.nP50 << "us\tp99=" << health.callback.nP99
+                           << "us\tMax=" << health.callback.nMax << "us";
+    m_pAgent->RecorderHealthChanged(health);
+    m_lastHealth = health;
+
+    for(auto& pPair : m_vPairs)
+    {
+        uint64_t nDropped = pPair->pCapture->GetDroppedFrames();
+        unsigned int nHighWater = pPair->pCapture->CollectHighWater();
+        if(nDropped != pPair->nDroppedFrames)
+        {
+            pmlLog(pml::LOG_WARN) << "Compi\tPair " << pPair->nIndex+1 << "\t" << nDropped-pPair->nDroppedFrames << " frames dropped since last report. High water " << nHighWater << "%";
+            pPair->nDroppedFrames = nDropped;
+        }
+        m_pAgent->PairHealthChanged(pPair->nIndex, nDropped, nHighWater);
+    }
+}
+
+void Compi::UpdatePreciseDelay(const AnalysisJob& job)
+{
+    //only the streaming correlator interpolates - the other checks just have the whole sample offset
+    double dOffset = (job.delay.nOffset == job.result.first) ? job.delay.dOffset : job.result.first;
+    double dQuality = (job.delay.nOffset == job.result.first) ? job.delay.dQuality : 0.0;
+
+    //the offset is between the views, which the Recorder has already shifted by the locked delay, so add that shift back on
+    dOffset += PositionDistance(job.window.second.GetPosition(), job.window.first.GetPosition());
+
+    m_pAgent->PreciseDelayChanged(std::chrono::microseconds(static_cast<long>(std::round(dOffset*1e6/m_nSampleRate))), static_cast<int>(std::round(dQuality*100.0)), job.pPair->nIndex);
+}
+
+void Compi::UpdateSNMP(MonitoredPair& pair, const hashresult& result, bool bJustLocked)
 {
     if(m_nMask == FORCE_ON || (m_nMask == FOLLOW_ACTIVE && m_bActive) || !m_bSendOnActiveOnly)
     {
         //send the traps
-        m_pAgent->AudioChanged(1);  //audio must be okay as we are here
+        m_pAgent->AudioChanged(1, pair.nIndex);  //audio must be okay as we are here
         //we only say comparison has failed if it has failed for more than the max failures we are allowing
-        if(m_nFailureCount >= m_nFailures)
+        if(pair.nFailureCount >= m_nFailures)
         {
-            m_pAgent->ComparisonChanged(0);
-            m_nFailureCount = 0;
+            m_pAgent->ComparisonChanged(0, pair.nIndex);
+            pair.nFailureCount = 0;
         }
         else
         {
-            m_pAgent->ComparisonChanged(1);
+            m_pAgent->ComparisonChanged(1, pair.nIndex);
         }
         if(bJustLocked)
         {
-            m_pAgent->DelayChanged(std::chrono::milliseconds(result.first*1000/m_nSampleRate));
+            m_pAgent->DelayChanged(std::chrono::milliseconds(result.first*1000/m_nSampleRate), pair.nIndex);
         }
     }
 }
@@ -289,8 +672,11 @@ void Compi::ClearSNMP()
 {
     if(m_bSendOnActiveOnly)
     {
-        m_pAgent->AudioChanged(1);
-        m_pAgent->ComparisonChanged(1);
+        for(size_t i = 0; i < m_vPairs.size(); i++)
+        {
+            m_pAgent->AudioChanged(1, i);
+            m_pAgent->ComparisonChanged(1, i);
+        }
     }
 }
 
@@ -304,7 +690,11 @@ int Compi::Run(const std::string& sPath)
         m_tpLogBeat = std::chrono::system_clock::now();
 
         SetupAgent();
-        SetupRecorder();
+        if(SetupRecorder() == false)
+        {   //stop the agent thread so it can be joined
+            g_bRun = false;
+            return -1;
+        }
 
 
         m_dFFTChangeDown = m_iniConfig.GetIniDouble("FFTDiff", "Down", 0.05);
@@ -384,31 +774,31 @@ bool Compi::ActivateCallback(Snmp_pp::SnmpSyntax* pValue, int nSyntax)
 }
 
 
-bool Compi::CheckSilence(float dPeak, enumLeg eLeg)
+bool Compi::CheckSilence(MonitoredPair& pair, float dPeak, enumLeg eLeg)
 {
     if(dPeak < m_dSilenceThreshold)
     {
-        if(m_nSilent[eLeg] != 1)
+        if(pair.nSilent[eLeg] != 1)
         {
-            m_nSilent[eLeg] = 1;
-            m_tpSilence[eLeg] = std::chrono::system_clock::now();
+            pair.nSilent[eLeg] = 1;
+            pair.tpSilence[eLeg] = std::chrono::system_clock::now();
         }
         else
         {
-            auto secondsSilent = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now()-m_tpSilence[eLeg]);
+            auto secondsSilent = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now()-pair.tpSilence[eLeg]);
             if(secondsSilent.count() > m_nSilenceHoldoff)
             {
-                m_pAgent->SilenceChanged(true, eLeg);
+                m_pAgent->SilenceChanged(true, eLeg, pair.nIndex);
             }
 
         }
     }
-    else if(m_nSilent[eLeg] != 0)
+    else if(pair.nSilent[eLeg] != 0)
     {
-        m_nSilent[eLeg] = 0;
-        m_pAgent->SilenceChanged(false, eLeg);
+        pair.nSilent[eLeg] = 0;
+        m_pAgent->SilenceChanged(false, eLeg, pair.nIndex);
     }
-    return (m_nSilent[eLeg] == 1);
+    return (pair.nSilent[eLeg] == 1);
 }
 
 
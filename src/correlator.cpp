@@ -0,0 +1,501 @@
+#include "correlator.h"
+#include <cmath>
+#include <algorithm>
+#include "log.h"
+#include "ringbuffer.h"
+#include "threadcache.h"
+
+static const size_t MAX_CACHED_CORRELATORS = 4;
+static const size_t FINE_MIN = 8192;    ///< shortest full rate correlation used to refine a coarse lag
+static const double TRACK_MIN_CORRELATION = 0.2;    ///< normalised correlation below which a tracking peak is treated as lost
+
+/** Fits a parabola through the peak bin and its neighbours (all with the peak's sign made positive) to find where the true peak lies.
+*   The fitted peak is always within half a bin of nPeak, so no bigger FFT is needed for sub-sample precision
+**/
+static delayEstimate InterpolatePeak(long nPeak, double dBefore, double dPeak, double dAfter)
+{
+    delayEstimate estimate;
+    estimate.nOffset = static_cast<int>(nPeak);
+    estimate.dOffset = nPeak;
+
+    double dCurvature = dBefore - 2.0*dPeak + dAfter;
+    if(dPeak > 0.0 && dCurvature < 0.0)
+    {
+        estimate.dOffset += 0.5*(dBefore-dAfter)/dCurvature;
+        estimate.dQuality = std::min(1.0, -dCurvature/(2.0*dPeak));
+    }
+    return estimate;
+}
+
+Correlator::Correlator(size_t nSize) :
+    m_nSize(nSize),
+    m_cfg(kiss_xcorr_alloc(nSize)),
+    m_vWindow(nSize),
+    m_vBufferA(nSize),
+    m_vBufferB(nSize),
+    m_vOut(nSize)
+{
+    pmlLog(pml::LOG_DEBUG) << "Correlator\tCreate correlator of size " << nSize;
+    if(!m_cfg)
+    {
+        pmlLog(pml::LOG_ERROR) << "Correlator\tCould not allocate cross-correlation of size " << nSize;
+    }
+
+    for(size_t i = 0; i < m_nSize; i++)
+    {
+        m_vWindow[i] = 0.5*(1.0 - cos((2*M_PI)*i/(m_nSize-1)));
+    }
+}
+
+Correlator::~Correlator()
+{
+    kiss_xcorr_free(m_cfg);
+}
+
+int Correlator::CalculateOffset(const AudioView& bufferA, const AudioView& bufferB)
+{
+    return EstimateDelay(bufferA, bufferB).nOffset;
+}
+
+delayEstimate Correlator::EstimateDelay(const AudioView& bufferA, const AudioView& bufferB)
+{
+    if(!m_cfg || bufferA.size() < m_nSize || bufferB.size() < m_nSize)
+    {
+        return delayEstimate();
+    }
+
+    for(size_t i = 0; i < m_nSize; i++)
+    {
+        m_vBufferA[i] = bufferA[i]*m_vWindow[i];
+        m_vBufferB[i] = bufferB[i]*m_vWindow[i];
+    }
+
+    rfft_xcorr_cfg(m_cfg, m_vBufferA.data(), m_vBufferB.data(), m_vOut.data(), KISS_XCORR);
+
+
+    long pos_peak_pos = 0;
+    long neg_peak_pos = 0;
+    double biggest = m_vOut[0];
+    double smallest = m_vOut[0];
+
+    // now search for positive and negative peaks in correlation function
+    for(unsigned int n=0; n<m_vOut.size(); n++)
+    {
+        if(m_vOut[n] > biggest)
+        {
+            biggest = m_vOut[n];
+            pos_peak_pos = n;
+        }
+        if(m_vOut[n] < smallest)
+        {
+            smallest = m_vOut[n];
+            neg_peak_pos = n;
+        }
+    }
+
+    bool bNegative = (biggest < fabs(smallest));
+    long nPeak = bNegative ? neg_peak_pos : pos_peak_pos;
+    double dSign = bNegative ? -1.0 : 1.0;
+
+    //the correlation is circular so the neighbours of the first and last bins wrap round
+    delayEstimate estimate = InterpolatePeak(nPeak, dSign*m_vOut[(nPeak+m_nSize-1)%m_nSize], dSign*m_vOut[nPeak], dSign*m_vOut[(nPeak+1)%m_nSize]);
+    if (static_cast<size_t>(nPeak) > m_nSize/2)
+    {
+        estimate.nOffset -= m_nSize;
+        estimate.dOffset -= m_nSize;
+    }
+
+    return estimate;
+}
+
+
+Correlator& GetCorrelator(size_t nSize)
+{
+    //one cache per thread as the correlator's scratch buffers can't be shared
+    return GetThreadCached<Correlator>(nSize, MAX_CACHED_CORRELATORS);
+}
+
+
+
+static void Decimate(const AudioView& buffer, size_t nDecimation, std::vector<float>& vOut)
+{
+    vOut.resize(buffer.size()/nDecimation);
+    const float dScale = 1.0/nDecimation;
+    for(size_t i = 0; i < vOut.size(); i++)
+    {
+        const float* pBlock = buffer.data()+i*nDecimation;
+        float dSum = 0.0;
+        for(size_t j = 0; j < nDecimation; j++)
+        {
+            dSum += pBlock[j];
+        }
+        vOut[i] = dSum*dScale;
+    }
+}
+
+delayEstimate EstimateDelayCoarseToFine(const AudioView& bufferA, const AudioView& bufferB, size_t nDecimation)
+{
+    size_t nSize = std::min(bufferA.size(), bufferB.size());
+    if(nDecimation < 2 || nSize/nDecimation < FINE_MIN)
+    {
+        return GetCorrelator(nSize).EstimateDelay(bufferA, bufferB);
+    }
+
+    //coarse pass
+    thread_local std::vector<float> vDecimatedA;
+    thread_local std::vector<float> vDecimatedB;
+    Decimate(bufferA.SubView(0, nSize), nDecimation, vDecimatedA);
+    Decimate(bufferB.SubView(0, nSize), nDecimation, vDecimatedB);
+
+    long nCoarse = GetCorrelator(vDecimatedA.size()).CalculateOffset(AudioView(vDecimatedA.data(), vDecimatedA.size()),
+                                                                   AudioView(vDecimatedB.data(), vDecimatedB.size()))*static_cast<long>(nDecimation);
+
+    //fine pass on the middle of the part of the two legs that overlap at the coarse lag. The coarse lag is only good to a decimated
+    //sample or so, so the fine window is kept long enough to search well beyond that
+    size_t nOverlap = nSize-std::min(nSize, static_cast<size_t>(std::abs(nCoarse)));
+    size_t nFine = std::min(std::max(FINE_MIN, 32*nDecimation), nOverlap);
+    if(nFine < FINE_MIN)
+    {
+        return GetCorrelator(nSize).EstimateDelay(bufferA, bufferB);
+    }
+
+    size_t nStartB = (nCoarse < 0 ? -nCoarse : 0) + (nOverlap-nFine)/2;
+    size_t nStartA = nStartB + nCoarse;
+
+    delayEstimate estimate = GetCorrelator(nFine).EstimateDelay(bufferA.SubView(nStartA, nFine), bufferB.SubView(nStartB, nFine));
+    estimate.nOffset += nCoarse;
+    estimate.dOffset += nCoarse;
+
+    pmlLog(pml::LOG_DEBUG) << "Correlator\tCoarse=" << nCoarse << "\tFine=" << estimate.dOffset << "\tQuality=" << estimate.dQuality;
+    return estimate;
+}
+
+delayEstimate EstimateDelay(const AudioView& bufferA, const AudioView& bufferB)
+{
+    if(std::min(bufferA.size(), bufferB.size()) >= COARSE_TO_FINE_MIN)
+    {
+        return EstimateDelayCoarseToFine(bufferA, bufferB);
+    }
+    return GetCorrelator(bufferA.size()).EstimateDelay(bufferA, bufferB);
+}
+
+
+
+bool TrackDelay(const AudioView& bufferA, const AudioView& bufferB, long nCentre, size_t nRange, delayEstimate& estimate)
+{
+    //one extra lag each side so the parabola can be fitted at the edges of the range
+    long nFirstLag = nCentre-static_cast<long>(nRange)-1;
+    long nLastLag = nCentre+static_cast<long>(nRange)+1;
+
+    //B samples for which A[t+lag] exists for every lag
+    long nStart = std::max(0l, -nFirstLag);
+    long nEnd = std::min(static_cast<long>(bufferB.size()), static_cast<long>(bufferA.size())-nLastLag);
+    if(nEnd-nStart < static_cast<long>(nRange)*2)
+    {
+        return false;
+    }
+    nStart = std::max(nStart, nEnd-static_cast<long>(TRACK_SAMPLES));
+
+    //accumulate every lag for each B sample - the inner loop runs along A so it vectorises
+    thread_local std::vector<float> vSums;
+    vSums.assign(nLastLag-nFirstLag+1, 0.0);
+    float* pSums = vSums.data();
+    const size_t nLags = vSums.size();
+    for(long t = nStart; t < nEnd; t++)
+    {
+        const float dB = bufferB[t];
+        const float* pA = bufferA.data()+t+nFirstLag;
+        for(size_t i = 0; i < nLags; i++)
+        {
+            pSums[i] += pA[i]*dB;
+        }
+    }
+
+    size_t nPeak = 1;
+    for(size_t i = 2; i < nLags-1; i++)
+    {
+        if(fabs(vSums[i]) > fabs(vSums[nPeak]))
+        {
+            nPeak = i;
+        }
+    }
+    if(nPeak == 1 || nPeak == nLags-2)
+    {
+        return false;
+    }
+
+    //the peak has to be a real correlation rather than the biggest of a set of noise values
+    //index A from t rather than offsetting a pointer by the lag first, which would point before the buffer for a negative lag
+    const long nPeakLag = nFirstLag+static_cast<long>(nPeak);
+    double dEnergyA = 0.0;
+    double dEnergyB = 0.0;
+    for(long t = nStart; t < nEnd; t++)
+    {
+        const float dA = bufferA[t+nPeakLag];
+        dEnergyA += dA*dA;
+        dEnergyB += bufferB[t]*bufferB[t];
+    }
+    if(dEnergyA <= 0.0 || dEnergyB <= 0.0)
+    {
+        return false;
+    }
+
+    //normalise to correlation coefficients so the peak height is 1 for identical legs whatever their level
+    double dScale = (vSums[nPeak] < 0.0 ? -1.0 : 1.0)/sqrt(dEnergyA*dEnergyB);
+    double dPeak = dScale*vSums[nPeak];
+    if(dPeak < TRACK_MIN_CORRELATION)
+    {
+        return false;
+    }
+
+    estimate = InterpolatePeak(nPeakLag, dScale*vSums[nPeak-1], dPeak, dScale*vSums[nPeak+1]);
+
+    //a time domain correlation of programme audio is a broad hump rather than GCC-PHAT's spike, so its curvature says little about the match.
+    //Report the correlation coefficient instead, which is on the same 0 (no match) to 1 (identical) scale
+    estimate.dQuality = std::min(1.0, dPeak);
+    return true;
+}
+
+
+
+StreamingCorrelator::StreamingCorrelator(double dForget) :
+    m_dForget(dForget)
+{
+
+}
+
+StreamingCorrelator::~StreamingCorrelator()
+{
+    free(m_fft_fwd);
+    free(m_fft_bwd);
+}
+
+void StreamingCorrelator::Configure(size_t nMaxLag)
+{
+    free(m_fft_fwd);
+    free(m_fft_bwd);
+
+    //each block of A has to cover the block of B plus the maximum lag either side of it
+    m_nMaxLag = nMaxLag;
+    m_nFFTSize = RingBuffer<float>::NextPowerOfTwo(nMaxLag*3);
+
+    //the most B a block could hold is what's left of the FFT after the lags, but that grows with the window and the estimate is only updated
+    //once per block. Bound it so a change in delay is picked up quickly whatever the window. Shorter blocks just leave more of the FFT zero padded
+    m_nHop = std::min(m_nFFTSize - 2*m_nMaxLag, STREAMING_MAX_HOP);
+
+    m_fft_fwd = kiss_fftr_alloc(m_nFFTSize, 0, NULL, NULL);
+    m_fft_bwd = kiss_fftr_alloc(m_nFFTSize, 1, NULL, NULL);
+
+    m_vInA.assign(m_nFFTSize, 0.0);
+    m_vInB.assign(m_nFFTSize, 0.0);
+    m_vSpectrumA.resize(m_nFFTSize/2+1);
+    m_vSpectrumB.resize(m_nFFTSize/2+1);
+    m_vCross.resize(m_nFFTSize/2+1);
+    m_vCorrelation.resize(m_nFFTSize);
+
+    m_vHistoryA.reserve(m_nFFTSize+m_nHop);
+    m_vHistoryB.reserve(m_nFFTSize+m_nHop);
+
+    pmlLog(pml::LOG_DEBUG) << "StreamingCorrelator\tMaxLag=" << m_nMaxLag << "\tFFT=" << m_nFFTSize << "\tHop=" << m_nHop;
+
+    Reset();
+}
+
+void StreamingCorrelator::Release()
+{
+    if(m_nMaxLag == 0)
+    {
+        return;
+    }
+    pmlLog(pml::LOG_DEBUG) << "StreamingCorrelator\tRelease FFT=" << m_nFFTSize;
+
+    free(m_fft_fwd);
+    free(m_fft_bwd);
+    m_fft_fwd = nullptr;
+    m_fft_bwd = nullptr;
+    m_nMaxLag = m_nFFTSize = m_nHop = 0;
+
+    std::vector<float>().swap(m_vInA);
+    std::vector<float>().swap(m_vInB);
+    std::vector<kiss_fft_cpx>().swap(m_vSpectrumA);
+    std::vector<kiss_fft_cpx>().swap(m_vSpectrumB);
+    std::vector<kiss_fft_cpx>().swap(m_vCross);
+    std::vector<float>().swap(m_vCorrelation);
+    std::vector<float>().swap(m_vHistoryA);
+    std::vector<float>().swap(m_vHistoryB);
+
+    Reset();
+}
+
+void StreamingCorrelator::Reset()
+{
+    m_bStarted = false;
+    m_bValid = false;
+    m_nOffset = 0;
+    m_dOffset = 0.0;
+    m_dQuality = 0.0;
+    m_vHistoryA.clear();
+    m_vHistoryB.clear();
+    std::fill(m_vCross.begin(), m_vCross.end(), kiss_fft_cpx{0.0, 0.0});
+}
+
+void StreamingCorrelator::Restart(size_t nPosition)
+{
+    Reset();
+    m_bStarted = true;
+    m_nHistoryStart = nPosition;
+    m_nBlockStart = nPosition+m_nMaxLag;
+}
+
+int StreamingCorrelator::CalculateOffset(const AudioView& bufferA, const AudioView& bufferB)
+{
+    return EstimateDelay(bufferA, bufferB).nOffset;
+}
+
+delayEstimate StreamingCorrelator::EstimateDelay(const AudioView& bufferA, const AudioView& bufferB)
+{
+    size_t nMaxLag = std::min(bufferA.size(), bufferB.size())/2;
+    if(nMaxLag == 0)
+    {
+        m_lastEstimate = delayEstimate();
+        return m_lastEstimate;
+    }
+    if(nMaxLag*2 >= COARSE_TO_FINE_MIN)
+    {   //the streaming FFT has to be 3 times the maximum lag - for a 768k window that is 2^21 points and about 90MB of plans and buffers per pair.
+        //A coarse to fine search of each window needs a fraction of that so use it instead, and give back anything a shorter window left allocated
+        Release();
+        m_lastEstimate = ::EstimateDelay(bufferA, bufferB);
+        return m_lastEstimate;
+    }
+    if(nMaxLag != m_nMaxLag)
+    {
+        Configure(nMaxLag);
+    }
+
+    AddAudio(bufferA, bufferB);
+    if(ProcessBlocks())
+    {
+        CalculateCorrelation();
+    }
+
+    if(!m_bValid)
+    {
+        m_lastEstimate = ::EstimateDelay(bufferA, bufferB);
+        return m_lastEstimate;
+    }
+
+    //the views may not start at the same capture position (Recorder shifts them once locked) so convert to an offset between the views
+    long nShift = PositionDistance(bufferB.GetPosition(), bufferA.GetPosition());
+    m_lastEstimate.nOffset = static_cast<int>(m_nOffset - nShift);
+    m_lastEstimate.dOffset = m_dOffset - nShift;
+    m_lastEstimate.dQuality = m_dQuality;
+
+    pmlLog(pml::LOG_DEBUG) << "StreamingCorrelator\tOffset=" << m_dOffset << "\tView offset=" << m_lastEstimate.dOffset << "\tQuality=" << m_dQuality;
+    return m_lastEstimate;
+}
+
+void StreamingCorrelator::AddAudio(const AudioView& bufferA, const AudioView& bufferB)
+{
+    //work out the capture positions both views cover
+    size_t nStart = PositionDistance(bufferB.GetPosition(), bufferA.GetPosition()) >= 0 ? bufferA.GetPosition() : bufferB.GetPosition();
+    size_t nEndA = bufferA.GetPosition()+bufferA.size();
+    size_t nEndB = bufferB.GetPosition()+bufferB.size();
+    size_t nEnd = PositionDistance(nEndB, nEndA) <= 0 ? nEndA : nEndB;
+
+    size_t nNext = m_nHistoryStart+m_vHistoryA.size();
+    if(!m_bStarted || PositionDistance(nNext, nStart) > 0)
+    {   //first time or there is a gap in the audio (the Recorder has cleared its buffers) so start again
+        Restart(nStart);
+        nNext = nStart;
+    }
+
+    for(size_t nPosition = nNext; PositionDistance(nPosition, nEnd) > 0; ++nPosition)
+    {
+        m_vHistoryA.push_back(bufferA[nPosition-bufferA.GetPosition()]);
+        m_vHistoryB.push_back(bufferB[nPosition-bufferB.GetPosition()]);
+    }
+}
+
+bool StreamingCorrelator::ProcessBlocks()
+{
+    bool bProcessed(false);
+    size_t nInputA = m_nHop+2*m_nMaxLag;
+
+    while(PositionDistance(m_nBlockStart+m_nHop+m_nMaxLag, m_nHistoryStart+m_vHistoryA.size()) >= 0)
+    {
+        //A covers the block plus the maximum lag either side, B is the block itself lined up with the middle of A. Both zero padded
+        size_t nFirstA = PositionDistance(m_nHistoryStart, m_nBlockStart) - m_nMaxLag;
+        size_t nFirstB = PositionDistance(m_nHistoryStart, m_nBlockStart);
+
+        std::copy(m_vHistoryA.begin()+nFirstA, m_vHistoryA.begin()+nFirstA+nInputA, m_vInA.begin());
+        std::fill(m_vInA.begin()+nInputA, m_vInA.end(), 0.0);
+
+        std::fill(m_vInB.begin(), m_vInB.end(), 0.0);
+        std::copy(m_vHistoryB.begin()+nFirstB, m_vHistoryB.begin()+nFirstB+m_nHop, m_vInB.begin()+m_nMaxLag);
+
+        kiss_fftr(m_fft_fwd, m_vInA.data(), m_vSpectrumA.data());
+        kiss_fftr(m_fft_fwd, m_vInB.data(), m_vSpectrumB.data());
+
+        for(size_t i = 0; i < m_vCross.size(); i++)
+        {
+            //A * conj(B)
+            float dReal = m_vSpectrumA[i].r*m_vSpectrumB[i].r + m_vSpectrumA[i].i*m_vSpectrumB[i].i;
+            float dImag = m_vSpectrumA[i].i*m_vSpectrumB[i].r - m_vSpectrumA[i].r*m_vSpectrumB[i].i;
+            m_vCross[i].r = m_dForget*m_vCross[i].r + dReal;
+            m_vCross[i].i = m_dForget*m_vCross[i].i + dImag;
+        }
+
+        m_nBlockStart += m_nHop;
+        bProcessed = true;
+
+        //throw away history that no future block needs
+        size_t nDiscard = PositionDistance(m_nHistoryStart, m_nBlockStart) - m_nMaxLag;
+        m_vHistoryA.erase(m_vHistoryA.begin(), m_vHistoryA.begin()+nDiscard);
+        m_vHistoryB.erase(m_vHistoryB.begin(), m_vHistoryB.begin()+nDiscard);
+        m_nHistoryStart += nDiscard;
+    }
+    return bProcessed;
+}
+
+void StreamingCorrelator::CalculateCorrelation()
+{
+    //PHAT weighting: keep only the phase of the accumulated cross-spectrum
+    std::vector<kiss_fft_cpx>& vWeighted = m_vSpectrumA;
+    for(size_t i = 0; i < m_vCross.size(); i++)
+    {
+        double dModulus = hypot(m_vCross[i].r, m_vCross[i].i);
+        if(dModulus > 1e-12)
+        {
+            vWeighted[i].r = m_vCross[i].r/dModulus;
+            vWeighted[i].i = m_vCross[i].i/dModulus;
+        }
+        else
+        {
+            vWeighted[i].r = vWeighted[i].i = 0.0;
+        }
+    }
+    kiss_fftri(m_fft_bwd, vWeighted.data(), m_vCorrelation.data());
+
+    //lags 0..MaxLag are at the start of the output, -MaxLag..-1 at the end
+    long nPeak = 0;
+    float dPeak = 0.0;
+    for(long nLag = -static_cast<long>(m_nMaxLag); nLag <= static_cast<long>(m_nMaxLag); nLag++)
+    {
+        float dValue = fabs(m_vCorrelation[nLag < 0 ? m_nFFTSize+nLag : nLag]);
+        if(dValue > dPeak)
+        {
+            dPeak = dValue;
+            nPeak = nLag;
+        }
+    }
+
+    //the FFT is at least 3*MaxLag long so the bins either side of +/-MaxLag are still lags rather than wrapped round
+    auto value = [this](long nLag){ return m_vCorrelation[nLag < 0 ? m_nFFTSize+nLag : nLag]; };
+    double dSign = value(nPeak) < 0.0 ? -1.0 : 1.0;
+    delayEstimate estimate = InterpolatePeak(nPeak, dSign*value(nPeak-1), dPeak, dSign*value(nPeak+1));
+
+    m_nOffset = nPeak;
+    m_dOffset = estimate.dOffset;
+    m_dQuality = estimate.dQuality;
+    m_bValid = (dPeak > 0.0);
+}
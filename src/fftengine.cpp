@@ -0,0 +1,88 @@
+#include "fftengine.h"
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "hash.h"
+#include "log.h"
+#include "threadcache.h"
+
+static const size_t MAX_CACHED_ENGINES = 4;
+
+FFTEngine::FFTEngine(size_t nSize) :
+    m_nSize(nSize),
+    m_cfg(kiss_fftr_alloc(nSize, 0, NULL, NULL)),
+    m_vWindow(nSize),
+    m_vIn(nSize)
+{
+    pmlLog(pml::LOG_DEBUG) << "FFTEngine\tCreate FFT of size " << nSize;
+    if(!m_cfg)
+    {
+        pmlLog(pml::LOG_ERROR) << "FFTEngine\tCould not allocate FFT of size " << nSize;
+    }
+
+    for(size_t i = 0; i < m_nSize; i++)
+    {
+        m_vWindow[i] = HannWindow(1.0, i, m_nSize);
+    }
+}
+
+FFTEngine::~FFTEngine()
+{
+    free(m_cfg);
+}
+
+void FFTEngine::Transform(const float* pIn, kiss_fft_cpx* pOut)
+{
+    if(!m_cfg)
+    {
+        return;
+    }
+
+    for(size_t i = 0; i < m_nSize; i++)
+    {
+        m_vIn[i] = pIn[i]*m_vWindow[i];
+    }
+    kiss_fftr(m_cfg, m_vIn.data(), pOut);
+}
+
+static inline float FastLog2(float dValue)
+{
+    uint32_t nBits;
+    memcpy(&nBits, &dValue, sizeof(nBits));
+
+    //split into exponent and mantissa, with the mantissa in [sqrt(0.5), sqrt(2)) so the series below converges quickly.
+    //This is all done on the bits so there are no branches (or floating point selects) to stop the loop vectorising
+    uint32_t nMantissa = nBits & 0x007fffff;
+    uint32_t nHigh = nMantissa > 0x003504f3 ? 1 : 0;    //mantissa bits of sqrt(2)
+    float dExponent = static_cast<float>(static_cast<int>((nBits >> 23) & 0xff) - 127 + static_cast<int>(nHigh));
+    nBits = nMantissa | (0x3f800000 - (nHigh << 23));
+    float dMantissa;
+    memcpy(&dMantissa, &nBits, sizeof(dMantissa));
+
+    //ln(m) = 2*atanh((m-1)/(m+1))
+    float t = (dMantissa-1.0f)/(dMantissa+1.0f);
+    float t2 = t*t;
+    float dLn = 2.0f*t*(1.0f + t2*(1.0f/3.0f + t2*(1.0f/5.0f + t2*(1.0f/7.0f))));
+
+    return dExponent + dLn*1.44269504f;
+}
+
+void MagnitudeToDb(const kiss_fft_cpx* pBins, size_t nBins, float dScale, float* pDb, float dFloor)
+{
+    //20*log10(|x|*scale) = 10*log10(2)*log2(|x|^2) + 20*log10(scale)
+    const float dOffset = 20.0f*log10(dScale);
+    const float dDbPerOctave = 3.01029996f;
+
+    for(size_t i = 0; i < nBins; i++)
+    {
+        float dPower = pBins[i].r*pBins[i].r + pBins[i].i*pBins[i].i + 1e-30f;  //the tiny offset keeps log away from 0 and denormals
+        pDb[i] = std::max(dDbPerOctave*FastLog2(dPower) + dOffset, dFloor);
+    }
+}
+
+FFTEngine& GetFFTEngine(size_t nSize)
+{
+    //one cache per thread as the engine's scratch buffer can't be shared
+    return GetThreadCached<FFTEngine>(nSize, MAX_CACHED_ENGINES);
+}
@@ -0,0 +1,233 @@
+#include "filesource.h"
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include "recorder.h"
+#include "log.h"
+
+namespace
+{
+    template<typename T> T ReadLittleEndian(const char* pBytes)
+    {
+        T value(0);
+        for(size_t i = 0; i < sizeof(T); i++)
+        {
+            value |= static_cast<T>(static_cast<unsigned char>(pBytes[i])) << (8*i);
+        }
+        return value;
+    }
+}
+
+FileSource::FileSource(Recorder& recorder, const std::string& sPath, unsigned long nSampleRate, unsigned short nChannels, bool bRealTime, bool bLoop) :
+PacedSource(recorder, nSampleRate, nChannels, bRealTime),
+m_sPath(sPath),
+m_bLoop(bLoop),
+m_eFormat(RAW_FLOAT),
+m_nFileChannels(nChannels),
+m_nDataStart(0),
+m_nDataFrames(0),
+m_nReadFrames(0)
+{
+
+}
+
+FileSource::~FileSource()
+{
+    StopThread();
+}
+
+bool FileSource::Open()
+{
+    m_ifs.open(m_sPath, std::ios::binary);
+    if(!m_ifs.is_open())
+    {
+        pmlLog(pml::LOG_CRITICAL) << "FileSource\tCould not open " << m_sPath;
+        return false;
+    }
+
+    char sMagic[4];
+    if(m_ifs.read(sMagic, 4) && std::memcmp(sMagic, "RIFF", 4) == 0)
+    {
+        if(!ReadWavHeader())
+        {
+            return false;
+        }
+    }
+    else
+    {   //no RIFF header so treat it as raw interleaved float at the configured sample rate
+        m_ifs.clear();
+        m_ifs.seekg(0, std::ios::end);
+        m_eFormat = RAW_FLOAT;
+        m_nFileChannels = m_nChannels;
+        m_nDataStart = 0;
+        m_nDataFrames = static_cast<unsigned long long>(m_ifs.tellg())/(sizeof(float)*m_nChannels);
+        pmlLog(pml::LOG_INFO) << "FileSource\t" << m_sPath << " is not a WAV file. Reading it as raw float with " << m_nChannels << " channels";
+    }
+
+    if(m_nFileChannels < m_nChannels)
+    {
+        pmlLog(pml::LOG_CRITICAL) << "FileSource\t" << m_sPath << " has " << m_nFileChannels << " channels but " << m_nChannels << " are needed";
+        return false;
+    }
+    if(m_nDataFrames < Recorder::FRAMES_PER_BUFFER)
+    {
+        pmlLog(pml::LOG_CRITICAL) << "FileSource\t" << m_sPath << " does not contain any audio";
+        return false;
+    }
+
+    pmlLog(pml::LOG_INFO) << "FileSource\tOpened " << m_sPath << ": " << m_nDataFrames << " frames (" << m_nDataFrames/m_nSampleRate << "s)";
+    return Rewind();
+}
+
+bool FileSource::ReadWavHeader()
+{
+    char header[8];
+    char sWave[4];
+    if(!m_ifs.read(header, 4) || !m_ifs.read(sWave, 4) || std::memcmp(sWave, "WAVE", 4) != 0)
+    {
+        pmlLog(pml::LOG_CRITICAL) << "FileSource\t" << m_sPath << " is a RIFF file but not a WAV file";
+        return false;
+    }
+
+    bool bFormat(false);
+    unsigned short nBitsPerSample(0);
+    unsigned short nBlockAlign(0);
+    while(m_ifs.read(header, 8))
+    {
+        unsigned long nChunkSize = ReadLittleEndian<uint32_t>(header+4);
+        if(std::memcmp(header, "fmt ", 4) == 0)
+        {
+            std::vector<char> vFormat(nChunkSize);
+            if(nChunkSize < 16 || !m_ifs.read(vFormat.data(), nChunkSize))
+            {
+                break;
+            }
+            unsigned short nFormat = ReadLittleEndian<uint16_t>(vFormat.data());
+            m_nFileChannels = ReadLittleEndian<uint16_t>(vFormat.data()+2);
+            unsigned long nSampleRate = ReadLittleEndian<uint32_t>(vFormat.data()+4);
+            nBlockAlign = ReadLittleEndian<uint16_t>(vFormat.data()+12);
+            nBitsPerSample = ReadLittleEndian<uint16_t>(vFormat.data()+14);
+            if(nFormat == 0xFFFE && nChunkSize >= 26)
+            {   //WAVE_FORMAT_EXTENSIBLE: the real format is the start of the sub format GUID
+                nFormat = ReadLittleEndian<uint16_t>(vFormat.data()+24);
+            }
+
+            if(nFormat == 3 && nBitsPerSample == 32)
+            {
+                m_eFormat = FLOAT_32;
+            }
+            else if(nFormat == 1 && nBitsPerSample == 16)
+            {
+                m_eFormat = PCM_16;
+            }
+            else if(nFormat == 1 && nBitsPerSample == 24)
+            {
+                m_eFormat = PCM_24;
+            }
+            else if(nFormat == 1 && nBitsPerSample == 32)
+            {
+                m_eFormat = PCM_32;
+            }
+            else
+            {
+                pmlLog(pml::LOG_CRITICAL) << "FileSource\t" << m_sPath << " format " << nFormat << " with " << nBitsPerSample << " bits per sample is not supported";
+                return false;
+            }
+
+            if(nSampleRate != m_nSampleRate)
+            {
+                pmlLog(pml::LOG_CRITICAL) << "FileSource\t" << m_sPath << " sample rate is " << nSampleRate << " but the recorder is set to " << m_nSampleRate;
+                return false;
+            }
+            bFormat = true;
+        }
+        else if(std::memcmp(header, "data", 4) == 0)
+        {
+            if(!bFormat || nBlockAlign != m_nFileChannels*nBitsPerSample/8)
+            {
+                break;
+            }
+            m_nDataStart = m_ifs.tellg();
+
+            //a recorder that was stopped before it finished writing the header leaves the size as 0 or 0xFFFFFFFF so use the rest of the file
+            m_ifs.seekg(0, std::ios::end);
+            unsigned long long nAvailable = static_cast<unsigned long long>(m_ifs.tellg()-m_nDataStart);
+            if(nChunkSize != 0 && nChunkSize != 0xFFFFFFFF)
+            {
+                nAvailable = std::min<unsigned long long>(nAvailable, nChunkSize);
+            }
+            m_nDataFrames = nAvailable/nBlockAlign;
+            return true;
+        }
+        else
+        {
+            m_ifs.seekg(nChunkSize + (nChunkSize & 1), std::ios::cur);  //chunks are padded to an even number of bytes
+        }
+    }
+
+    pmlLog(pml::LOG_CRITICAL) << "FileSource\t" << m_sPath << " does not have a valid fmt and data chunk";
+    return false;
+}
+
+bool FileSource::Rewind()
+{
+    m_ifs.clear();
+    m_ifs.seekg(m_nDataStart);
+    m_nReadFrames = 0;
+    return m_ifs.good();
+}
+
+size_t FileSource::ReadFrames(float* pBuffer, size_t nFrames)
+{
+    nFrames = std::min<unsigned long long>(nFrames, m_nDataFrames-m_nReadFrames);
+
+    size_t nBytesPerSample = (m_eFormat == PCM_16 ? 2 : (m_eFormat == PCM_24 ? 3 : 4));
+    size_t nBytesPerFrame = nBytesPerSample*m_nFileChannels;
+    m_vRead.resize(nFrames*nBytesPerFrame);
+    if(!m_ifs.read(m_vRead.data(), m_vRead.size()))
+    {
+        return 0;
+    }
+    m_nReadFrames += nFrames;
+
+    for(size_t i = 0; i < nFrames; i++)
+    {
+        const char* pFrame = m_vRead.data()+i*nBytesPerFrame;
+        for(size_t nChannel = 0; nChannel < m_nChannels; nChannel++)
+        {
+            const char* pSample = pFrame+nChannel*nBytesPerSample;
+            float& dSample = pBuffer[i*m_nChannels+nChannel];
+            switch(m_eFormat)
+            {
+                case PCM_16:
+                    dSample = static_cast<int16_t>(ReadLittleEndian<uint16_t>(pSample))/32768.0f;
+                    break;
+                case PCM_24:
+                {   //only 3 bytes belong to this sample, so build it from those and sign extend from the top byte
+                    int32_t nSample = static_cast<int32_t>(static_cast<unsigned char>(pSample[0])) |
+                                      static_cast<int32_t>(static_cast<unsigned char>(pSample[1])) << 8 |
+                                      static_cast<int32_t>(static_cast<signed char>(pSample[2])) * 65536;
+                    dSample = nSample/8388608.0f;
+                    break;
+                }
+                case PCM_32:
+                    dSample = static_cast<int32_t>(ReadLittleEndian<uint32_t>(pSample))/2147483648.0f;
+                    break;
+                default:
+                    std::memcpy(&dSample, pSample, sizeof(float));
+            }
+        }
+    }
+    return nFrames;
+}
+
+size_t FileSource::FillBlock(float* pBuffer, size_t nFrames)
+{
+    size_t nRead = ReadFrames(pBuffer, nFrames);
+    if(nRead < nFrames && m_bLoop && Rewind())
+    {   //start again rather than deliver a part block
+        nRead = ReadFrames(pBuffer, nFrames);
+    }
+    return nRead;
+}
@@ -1,179 +1,94 @@
-#include "hash.h"
-#include "audiophash.h"
+#include "hash.h"
+#include "audiophash.h"
 #include <thread>
 #include <iomanip>
+#include <cstdlib>
+#include <algorithm>
 #include "log.h"
-#include "kiss_xcorr.h"
-
-const unsigned long SAMPLE_RATE = 48000;
+#include "correlator.h"
+#include "fftengine.h"
 
 
 
-
-hashresult CalculateHash(const std::deque<float>& bufferA, const std::deque<float>& bufferB, size_t nSampleSize, bool bLocked)
-{
-
-    std::vector<float> vBufferA(std::begin(bufferA), std::end(bufferA));
-    std::vector<float> vBufferB(std::begin(bufferB), std::end(bufferB));
 
+bool GetHashRanges(const AudioView& vBufferA, const AudioView& vBufferB, size_t nSampleSize, int nOffset, hashrange& rangeA, hashrange& rangeB)
+{
+    size_t nOffsetA(0);
+    size_t nOffsetB(0);
 
-    pmlLog(pml::LOG_DEBUG) << "CalculateHash\tCheck if tone";
-    if(CheckForTone(vBufferA, vBufferB))
+    if(nOffset < 0)
     {
-        pmlLog(pml::LOG_DEBUG) << "CalculateHash\tTONE";
-        return std::make_pair(0, 1.0);
+        nOffsetB = static_cast<size_t>(-nOffset);
     }
-
-    hashresult result = std::make_pair(0,-1.0);
-
-    pmlLog(pml::LOG_DEBUG) << "CalculateHash\tGet Offset: Window size=" << nSampleSize;
-
-
-    size_t nOffsetA(0);
-    size_t nOffsetB(0);
-
-    //if(!bLocked)
+    else
     {
-        result.first = CalculateOffset(vBufferA, vBufferB);
-        if(result.first < 0)
-        {
-            nOffsetB = static_cast<size_t>(-result.first);
-        }
-        else
-        {
-            nOffsetA = static_cast<size_t>(result.first);
-        }
-
-        pmlLog(pml::LOG_DEBUG) << "CalculateHash\tOffsetA=" << nOffsetA << "\tOffsetB=" << nOffsetB;
+        nOffsetA = static_cast<size_t>(nOffset);
     }
-
-
-    pmlLog(pml::LOG_DEBUG) << "CalculateHash\tStarting Hash Check";
-
-    if(nOffsetA+nSampleSize <= vBufferA.size() && nOffsetB+nSampleSize <= vBufferB.size())
-    {
-        int nSamplesA(std::min(vBufferA.size()-nOffsetA, nSampleSize));
-        int nSamplesB(std::min(vBufferB.size()-nOffsetB, nSampleSize));
-        int nSamples(std::min(nSamplesA, nSamplesB));
-
-        pmlLog(pml::LOG_DEBUG) << "CalculateHash\tComparing "<< nSamples << " samples [" << nSamplesA << "," << nSamplesB << "]";
-
-        if(nSamples > 0)
-        {
-
-            int nHashA;
-            int nHashB;
-
-            //get the hash numbers ofr left and right channels
-
-//            std::vector<float> vTempA(vBufferA.begin()+nOffsetA, vBufferA.begin()+nOffsetA+nSamples);
-//            std::vector<float> vTempB(vBufferB.begin()+nOffsetB, vBufferB.begin()+nOffsetB+nSamples);
-
-            //copy and check for silence...
-            std::vector<float> vTempA(nSamples);
-            std::vector<float> vTempB(nSamples);
-
-            for(int i = 0; i < nSamples; i++)
-            {
-                vTempA[i] = vBufferA[i+nOffsetA];
-                vTempB[i] = vBufferB[i+nOffsetB];
-            }
-
-            uint32_t* pHashA(ph_audiohash(vTempA.data(), vTempA.size(), SAMPLE_RATE, nHashA));
-            uint32_t* pHashB(ph_audiohash(vTempB.data(), vTempB.size(), SAMPLE_RATE, nHashB));
-
-            if(pHashB && pHashA && nHashA > 0 && nHashB > 0)
-            {
-                int nConfidenceLength;
-                int nFrames = std::min(nHashA, nHashB);
-                pmlLog(pml::LOG_DEBUG) << "CalculateHash\tHash size: A=" << nHashA << "\tB=" << nHashB;
-                double* pResult =ph_audio_distance_ber(pHashB, nHashB, pHashA, nHashA, 0.30, nFrames, nConfidenceLength);
-
-                for (int i=0;i<nConfidenceLength;i++)
-                {
-                    if (pResult[i] > result.second)
-                    {
-                        result.second = pResult[i];
-                    }
-                }
-                free(pResult);
-                free(pHashB);
-                free(pHashA);
-
-            }
-        }
-        else
-        {
-            pmlLog(pml::LOG_WARN) << "CalculateHash\tSample size too small for offset: Sample Size: " << nSampleSize << ", OffsetA " <<  nOffsetA
-            << ", BufferA " << vBufferA.size() << ", OffsetB " << nOffsetB << ", BufferB " << vBufferB.size();
-        }
-    }
-    else
-    {
-        pmlLog(pml::LOG_WARN) << "CalculateHash\tSample size too small for offset: Sample Size: " << nSampleSize << ", OffsetA " <<  nOffsetA
-            << ", BufferA " << vBufferA.size() << ", OffsetB " << nOffsetB << ", BufferB " << vBufferB.size();
-    }
 
-    pmlLog(pml::LOG_DEBUG) << "CalculateHash\tHash Check Finished: Confidence: " << result.second;
+    pmlLog(pml::LOG_DEBUG) << "CalculateHash\tOffsetA=" << nOffsetA << "\tOffsetB=" << nOffsetB;
 
-    return result;
-
-}
+    if(nOffsetA+nSampleSize <= vBufferA.size() && nOffsetB+nSampleSize <= vBufferB.size())
+    {
+        int nSamplesA(std::min(vBufferA.size()-nOffsetA, nSampleSize));
+        int nSamplesB(std::min(vBufferB.size()-nOffsetB, nSampleSize));
+        int nSamples(std::min(nSamplesA, nSamplesB));
 
+        pmlLog(pml::LOG_DEBUG) << "CalculateHash\tComparing "<< nSamples << " samples [" << nSamplesA << "," << nSamplesB << "]";
 
-void WindowData(std::vector<float>& vData)
-{
-	double angle;
-	for(size_t i = 0; i < vData.size(); i++)
-    {
-        angle = (2*M_PI)*i/(vData.size()-1);
-        vData[i] *= 0.5*(1.0 - cos(angle));
+        if(nSamples > 0)
+        {
+            rangeA = std::make_pair(vBufferA.GetPosition()+nOffsetA, vBufferA.GetPosition()+nOffsetA+nSamples);
+            rangeB = std::make_pair(vBufferB.GetPosition()+nOffsetB, vBufferB.GetPosition()+nOffsetB+nSamples);
+            return true;
+        }
     }
 
+    pmlLog(pml::LOG_WARN) << "CalculateHash\tSample size too small for offset: Sample Size: " << nSampleSize << ", OffsetA " <<  nOffsetA
+            << ", BufferA " << vBufferA.size() << ", OffsetB " << nOffsetB << ", BufferB " << vBufferB.size();
+    return false;
 }
 
-
-int CalculateOffset(std::vector<float> vBufferA, std::vector<float> vBufferB)
+void AlignHashes(std::vector<uint32_t>& vHashA, long nLateA, std::vector<uint32_t>& vHashB, long nLateB)
 {
+    //how far B's first frame is behind the audio that matches A's first frame, rounded to the nearest number of frames
+    long nMisaligned = nLateB-nLateA;
+    long nFrames = (std::abs(nMisaligned)+PH_AUDIOHASH_ADVANCE/2)/PH_AUDIOHASH_ADVANCE;
 
-    WindowData(vBufferA);
-    WindowData(vBufferB);
-
-    std::vector<float> vfft_out;
-    vfft_out.resize(vBufferA.size());
-
-    rfft_xcorr(vBufferA.size(), vBufferA.data(), vBufferB.data(), vfft_out.data(),KISS_XCORR);
-
+    std::vector<uint32_t>& vHash(nMisaligned > 0 ? vHashA : vHashB);
+    vHash.erase(vHash.begin(), vHash.begin()+std::min<size_t>(nFrames, vHash.size()));
 
+    pmlLog(pml::LOG_TRACE) << "CalculateHash\tAlign: A late by " << nLateA << "\tB late by " << nLateB << "\tdropped " << nFrames << (nMisaligned > 0 ? " from A" : " from B");
+}
 
-    long pos_peak_pos = 0;
-    long neg_peak_pos = 0;
-    double biggest = vfft_out[0];
-    double smallest = vfft_out[0];
+double CompareHashes(std::vector<uint32_t> vHashA, std::vector<uint32_t> vHashB)
+{
+    double dConfidence(-1.0);
 
-    // now search for positive and negative peaks in correlation function
-    for(unsigned int n=0; n<vfft_out.size(); n++)
+    int nHashA = vHashA.size();
+    int nHashB = vHashB.size();
+    if(nHashA > 0 && nHashB > 0)
     {
-        if(vfft_out[n] > biggest)
-        {
-            biggest = vfft_out[n];
-            pos_peak_pos = n;
-        }
-        if(vfft_out[n] < smallest)
+        int nConfidenceLength;
+        int nFrames = std::min(nHashA, nHashB);
+        pmlLog(pml::LOG_DEBUG) << "CalculateHash\tHash size: A=" << nHashA << "\tB=" << nHashB;
+        double* pResult =ph_audio_distance_ber(vHashB.data(), nHashB, vHashA.data(), nHashA, 0.30, nFrames, nConfidenceLength);
+
+        for (int i=0;i<nConfidenceLength;i++)
         {
-            smallest = vfft_out[n];
-            neg_peak_pos = n;
+            if (pResult[i] > dConfidence)
+            {
+                dConfidence = pResult[i];
+            }
         }
+        delete[] pResult;
     }
+    return dConfidence;
+}
 
 
-    size_t nBlockSize = vBufferA.size();
-
-    int offset =  ((biggest < fabs(smallest)) ?  neg_peak_pos : pos_peak_pos) ;
-    if ((size_t)offset > nBlockSize/2)
-    {
-        offset = offset - nBlockSize;
-    }
+int CalculateOffset(const AudioView& bufferA, const AudioView& bufferB)
+{
+    int offset = EstimateDelay(bufferA, bufferB).nOffset;
 
     pmlLog(pml::LOG_DEBUG) << "CalculateOffset=" << offset << " samples";
 
@@ -192,15 +107,12 @@ std::vector<std::pair<int, double>> GetPeaks(const std::vector<kiss_fft_cpx>& vf
     int nPeaks(0);
     bool bDown(false);
 
+    std::vector<float> vLog(vfft_out.size());
+    MagnitudeToDb(vfft_out.data(), vfft_out.size(), 1.0/static_cast<float>(vfft_out.size()), vLog.data());
+
     for(size_t i = 0; i < vfft_out.size(); i++)
     {
-        float dAmplitude(sqrt( (vfft_out[i].r*vfft_out[i].r) + (vfft_out[i].i*vfft_out[i].i)));
-        if(dAmplitude<0)
-        {
-            dAmplitude=-dAmplitude;
-        }
-        dAmplitude /= static_cast<float>(vfft_out.size());
-        double dLog = 20*log10(dAmplitude);
+        double dLog = vLog[i];
 
 
         if(dLog < dLastBin)
@@ -233,7 +145,7 @@ float HannWindow(float dIn, size_t nSample, size_t nSize)
     return 0.5*(1-cos((2*M_PI*static_cast<float>(nSample))/static_cast<float>(nSize-1)))*dIn;
 }
 
-bool CheckForTone(std::vector<float> vBufferA, std::vector<float> vBufferB)
+bool CheckForTone(const AudioView& vBufferA, const AudioView& vBufferB)
 {
     if(vBufferA.size() < 2046 || vBufferB.size() < 2046)
     {
@@ -242,35 +154,13 @@ bool CheckForTone(std::vector<float> vBufferA, std::vector<float> vBufferB)
     }
 
     size_t nBins = 1024;
-    std::vector<kiss_fft_scalar> vfftL((nBins-1*2));
-    std::vector<kiss_fft_scalar> vfftR((nBins-1*2));
-
     std::vector<kiss_fft_cpx> vfft_outL(nBins);
     std::vector<kiss_fft_cpx> vfft_outR(nBins);
 
-
-    for(size_t i = 0; i < vfftL.size(); i++)
-    {
-        vfftL[i] = HannWindow(vBufferA[i], i, vfftL.size());
-        vfftR[i] = HannWindow(vBufferB[i], i, vfftL.size());
-    }
-
-    //Now do the check
-    kiss_fftr_cfg cfgL;
-    kiss_fftr_cfg cfgR;
-
-
-    if ((cfgL = kiss_fftr_alloc(vfftL.size(), 0, NULL, NULL)) != NULL)
-    {
-        kiss_fftr(cfgL, vfftL.data(), vfft_outL.data());
-    }
-    free(cfgL);
-
-    if ((cfgR = kiss_fftr_alloc(vfftR.size(), 0, NULL, NULL)) != NULL)
-    {
-        kiss_fftr(cfgR, vfftR.data(), vfft_outR.data());
-    }
-    free(cfgR);
+    //Now do the check - the transform is 1022 samples so only the first half of the bins are filled, the rest stay at 0
+    FFTEngine& engine = GetFFTEngine(nBins-2);
+    engine.Transform(vBufferA.data(), vfft_outL.data());
+    engine.Transform(vBufferB.data(), vfft_outR.data());
 
 
     auto vPeaksL = std::move(GetPeaks(vfft_outL));
@@ -16,23 +16,55 @@ static int prod(const int *dims, int ndims) {
 	return x;
 }
 
-void rfft_xcorr(size_t n, const kiss_fft_scalar *x, const kiss_fft_scalar *y,
-		kiss_fft_scalar *z, int mode) {
+kiss_xcorr_cfg kiss_xcorr_alloc(size_t n) {
 	int freq_len = n / 2 + 1;
-	int i;
+	kiss_xcorr_cfg cfg = calloc(1, sizeof(struct kiss_xcorr_state));
+	if (cfg == NULL)
+		return NULL;
+
+	cfg->n = n;
 
 	// FFT configs
-	kiss_fftr_cfg fft_fwd = kiss_fftr_alloc(n, 0, NULL, NULL );
-	kiss_fftr_cfg fft_bwd = kiss_fftr_alloc(n, 1, NULL, NULL );
+	cfg->fft_fwd = kiss_fftr_alloc(n, 0, NULL, NULL );
+	cfg->fft_bwd = kiss_fftr_alloc(n, 1, NULL, NULL );
 
 	// Freq-domain data buffer
-	kiss_fft_cpx *X = calloc(freq_len, sizeof(kiss_fft_cpx));
-	kiss_fft_cpx *Y = calloc(freq_len, sizeof(kiss_fft_cpx));
-	kiss_fft_cpx *Z = calloc(freq_len, sizeof(kiss_fft_cpx));
+	cfg->X = calloc(freq_len, sizeof(kiss_fft_cpx));
+	cfg->Y = calloc(freq_len, sizeof(kiss_fft_cpx));
+	cfg->Z = calloc(freq_len, sizeof(kiss_fft_cpx));
+
+	if (!cfg->fft_fwd || !cfg->fft_bwd || !cfg->X || !cfg->Y || !cfg->Z) {
+		kiss_xcorr_free(cfg);
+		return NULL;
+	}
+	return cfg;
+}
+
+void kiss_xcorr_free(kiss_xcorr_cfg cfg) {
+	if (cfg == NULL)
+		return;
+
+	free(cfg->fft_fwd);
+	free(cfg->fft_bwd);
+
+	free(cfg->X);
+	free(cfg->Y);
+	free(cfg->Z);
+	free(cfg);
+}
+
+void rfft_xcorr_cfg(kiss_xcorr_cfg cfg, const kiss_fft_scalar *x,
+		const kiss_fft_scalar *y, kiss_fft_scalar *z, int mode) {
+	int freq_len = cfg->n / 2 + 1;
+	int i;
+
+	kiss_fft_cpx *X = cfg->X;
+	kiss_fft_cpx *Y = cfg->Y;
+	kiss_fft_cpx *Z = cfg->Z;
 
 	// Execute FWD_FFT
-	kiss_fftr(fft_fwd, x, X);
-	kiss_fftr(fft_fwd, y, Y);
+	kiss_fftr(cfg->fft_fwd, x, X);
+	kiss_fftr(cfg->fft_fwd, y, Y);
 
 	// Multiply in freq-domain
 	for (i = 0; i < freq_len; i++)
@@ -55,14 +87,18 @@ void rfft_xcorr(size_t n, const kiss_fft_scalar *x, const kiss_fft_scalar *y,
     }
 
 	// Execute BWD_FFT
-	kiss_fftri(fft_bwd, Z, z);
+	kiss_fftri(cfg->fft_bwd, Z, z);
+}
 
-	free(fft_fwd);
-	free(fft_bwd);
+void rfft_xcorr(size_t n, const kiss_fft_scalar *x, const kiss_fft_scalar *y,
+		kiss_fft_scalar *z, int mode) {
+	kiss_xcorr_cfg cfg = kiss_xcorr_alloc(n);
+	if (cfg == NULL)
+		return;
 
-	free(X);
-	free(Y);
-	free(Z);
+	rfft_xcorr_cfg(cfg, x, y, z, mode);
+
+	kiss_xcorr_free(cfg);
 }
 
 /*
@@ -0,0 +1,183 @@
+#include "legpair.h"
+#include <cmath>
+#include <algorithm>
+#include "log.h"
+
+LegPair::LegPair(unsigned long nSampleRate, const std::chrono::milliseconds& startDelay, const std::chrono::milliseconds& maxDelay, const std::chrono::milliseconds& minWindow) :
+m_nSampleRate(nSampleRate),
+m_nStartSamplesForDelay(startDelay.count()*m_nSampleRate/500),
+m_nSamplesForDelay(m_nStartSamplesForDelay),
+m_nMaxSamplesForDelay(maxDelay.count()*m_nSampleRate/500),
+m_nSamplesToHash((minWindow.count()*m_nSampleRate)/1000),
+m_BufferA(GetRingCapacity()),
+m_BufferB(GetRingCapacity()),
+m_bAdjustDelayWindow(m_nStartSamplesForDelay != m_nMaxSamplesForDelay),
+m_dPeakA(0.0),
+m_dPeakB(0.0),
+m_nOffset(0),
+m_bLocked(false),
+m_bReady(true)
+{
+
+}
+
+bool LegPair::Write(const float* pInterleaved, size_t nFrameCount, size_t nStride)
+{
+    //this runs on the audio thread so it must not block or allocate - if Compi has not freed enough space we drop the whole block from both legs so they stay in step
+    if(m_BufferA.GetSpace() < nFrameCount || m_BufferB.GetSpace() < nFrameCount)
+    {
+        m_nDroppedFrames.fetch_add(nFrameCount, std::memory_order_relaxed);
+        m_nHighWater.store(m_BufferA.GetCapacity(), std::memory_order_relaxed);   //counts as full
+        return false;
+    }
+
+    float dPeakA(0.0), dPeakB(0.0);
+    for(size_t i = 0; i < nFrameCount; i++)
+    {
+        m_BufferA.Write(i, pInterleaved[i*nStride]);
+        m_BufferB.Write(i, pInterleaved[i*nStride+1]);
+
+        dPeakA = std::max(std::abs(pInterleaved[i*nStride]), dPeakA);
+        dPeakB = std::max(std::abs(pInterleaved[i*nStride+1]), dPeakB);
+    }
+    m_BufferA.Commit(nFrameCount);
+    m_BufferB.Commit(nFrameCount);
+
+    size_t nFill = std::max(m_BufferA.GetSize(), m_BufferB.GetSize());
+    if(nFill > m_nHighWater.load(std::memory_order_relaxed))
+    {
+        m_nHighWater.store(nFill, std::memory_order_relaxed);
+    }
+
+    m_dPeakA = dPeakA;
+    m_dPeakB = dPeakB;
+
+
+    if(m_bReady)
+    {
+        size_t nRequired = m_nSamplesForDelay+m_nSamplesToHash+abs(m_nOffset);
+        if((m_nOffset < 0 && m_BufferA.GetSize() > nRequired) ||
+           (m_nOffset >= 0 && m_BufferB.GetSize() > nRequired))
+        {
+            m_bReady = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned int LegPair::CollectHighWater()
+{
+    return static_cast<unsigned int>(std::min<size_t>(100, m_nHighWater.exchange(0, std::memory_order_relaxed)*100/m_BufferA.GetCapacity()));
+}
+
+bool LegPair::BufferFull()
+{
+    return (m_bReady == false);
+}
+
+void LegPair::CompiReady()
+{
+    m_dPeakA = 0.0;
+    m_dPeakB = 0.0;
+    m_bReady = true;
+    pmlLog(pml::LOG_TRACE) << "LegPair\tCompi Ready";
+}
+
+
+std::chrono::milliseconds LegPair::GetMaxDelay()
+{
+    return std::chrono::milliseconds((m_nSamplesForDelay+m_nSamplesToHash+abs(m_nOffset))*500/m_nSampleRate);
+}
+
+
+std::chrono::milliseconds LegPair::GetExpectedTimeToFillBuffer()
+{
+    return std::chrono::milliseconds(((m_nSamplesForDelay+m_nSamplesToHash)*1000/m_nSampleRate)+2000); //add 2seconds to allow for things not working right
+}
+
+size_t LegPair::Locked(bool bLocked, long nOffset)
+{
+    pmlLog(pml::LOG_DEBUG) << "LegPair\tLocked: " << bLocked<<"\tOffset=" << nOffset;
+
+    std::lock_guard<std::mutex> lg(m_mutexInternal);
+
+
+    if(bLocked && m_bLocked == false)
+    {
+        m_nSamplesForDelay = m_nStartSamplesForDelay;
+        m_nOffset = nOffset;
+    }
+    else if(!bLocked && m_bAdjustDelayWindow)
+    {
+        m_nSamplesForDelay = std::min(std::max(m_nSamplesForDelay.load(), (size_t)m_nOffset)*2, m_nMaxSamplesForDelay);
+
+        m_nOffset = 0;
+
+        //B is always committed after A so its write position is one both legs have reached
+        size_t nPosition = m_BufferB.GetWritePosition();
+        m_BufferA.ConsumeTo(nPosition);
+        m_BufferB.ConsumeTo(nPosition);
+
+    }
+
+
+    m_bLocked = bLocked;
+
+    return GetMaxDelay().count();
+
+}
+
+deinterlacedView LegPair::CreateBuffer()
+{
+    std::lock_guard<std::mutex> lg(m_mutexInternal);
+    return TrimBuffer();
+}
+
+deinterlacedView LegPair::CopyBuffer(std::vector<float>& vBufferA, std::vector<float>& vBufferB)
+{
+    std::lock_guard<std::mutex> lg(m_mutexInternal);
+    deinterlacedView window(TrimBuffer());
+
+    vBufferA.assign(window.first.begin(), window.first.end());
+    vBufferB.assign(window.second.begin(), window.second.end());
+
+    return std::make_pair(AudioView(vBufferA.data(), vBufferA.size(), window.first.GetPosition()), AudioView(vBufferB.data(), vBufferB.size(), window.second.GetPosition()));
+}
+
+deinterlacedView LegPair::TrimBuffer()
+{
+    long nOffset = m_nOffset;
+    size_t nWindow = m_nSamplesForDelay+m_nSamplesToHash;
+    size_t nWindowA = nWindow + (nOffset < 0 ? -nOffset : 0);
+    size_t nWindowB = nWindow + (nOffset > 0 ? nOffset : 0);
+
+    //the callback may add more audio while we work so take one end position for both legs. B is always committed after A so its write position is one both legs have reached
+    size_t nEnd = m_BufferB.GetWritePosition();
+    size_t nSizeA = nEnd-m_BufferA.GetReadPosition();
+    size_t nSizeB = nEnd-m_BufferB.GetReadPosition();
+    if(nSizeA < nWindowA || nSizeB < nWindowB)
+    {
+        pmlLog(pml::LOG_WARN) << "LegPair\tBuffer too small: " << nSizeA << ", " << nSizeB;
+        return deinterlacedView();
+    }
+
+    m_BufferA.ConsumeTo(nEnd-nWindowA);
+    m_BufferB.ConsumeTo(nEnd-nWindowB);
+
+    pmlLog(pml::LOG_DEBUG) << "LegPair\tBuffer size: " << nWindowA << ", " << nWindowB;
+
+    return std::make_pair(AudioView(m_BufferA.GetData(0), nWindow, m_BufferA.GetReadPosition()), AudioView(m_BufferB.GetData(0), nWindow, m_BufferB.GetReadPosition()));
+}
+
+
+peak LegPair::GetPeak()
+{
+    return {m_dPeakA, m_dPeakB};
+}
+
+size_t LegPair::GetRingCapacity() const
+{
+    //the window can be extended by an offset of up to half of itself. Add a second on top to give Compi time to catch up
+    return (m_nMaxSamplesForDelay+m_nSamplesToHash)*3/2 + m_nSampleRate;
+}
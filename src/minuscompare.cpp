@@ -2,11 +2,10 @@
 #include <math.h>
 #include <iostream>
 #include "hash.h"
+#include "correlator.h"
 #include "log.h"
 #include <algorithm>
 
-double g_conf = 0.0;
-
 void Normalize(std::vector<float>& vAmplitude, double dMax)
 {
     if(dMax == 0.0)
@@ -20,7 +19,7 @@ void Normalize(std::vector<float>& vAmplitude, double dMax)
     }
 }
 
-std::vector<float> Minus(const std::vector<float>& vBufferA, const std::vector<float>& vBufferB)
+std::vector<float> Minus(const AudioView& vBufferA, const AudioView& vBufferB)
 {
     std::vector<float> vResult(vBufferA.size());
     for(size_t i = 0; i < vBufferA.size(); i++)
@@ -32,19 +31,15 @@ std::vector<float> Minus(const std::vector<float>& vBufferA, const std::vector<f
 }
 
 
-hashresult CalculateMinus(const std::deque<float>& bufferA, const std::deque<float>& bufferB, const peak& thePeak, size_t nSampleSize, bool bLocked, const std::pair<int, double>& last)
+hashresult CalculateMinus(const AudioView& vBufferA, const AudioView& vBufferB, const peak& thePeak, size_t nSampleSize, bool bLocked, const std::pair<int, double>& last, double& dConfidence, StreamingCorrelator& correlator)
 {
 
-    std::vector<float> vBufferA(std::begin(bufferA), std::end(bufferA));
-    std::vector<float> vBufferB(std::begin(bufferB), std::end(bufferB));
-
-
     pmlLog(pml::LOG_DEBUG) << "CalculateMinus\tCheck if tone";
     if(CheckForTone(vBufferA, vBufferB))
     {
         pmlLog(pml::LOG_DEBUG) << "CalculateMinus\tTONE";
-        g_conf = std::min(g_conf+0.1, 1.0);
-        return std::make_pair(0, g_conf);
+        dConfidence = std::min(dConfidence+0.1, 1.0);
+        return std::make_pair(0, dConfidence);
     }
 
     hashresult result = std::make_pair(0,-1.0);
@@ -53,7 +48,7 @@ hashresult CalculateMinus(const std::deque<float>& bufferA, const std::deque<flo
     size_t nOffsetA(0);
     size_t nOffsetB(0);
 
-    result.first = CalculateOffset(vBufferA, vBufferB);
+    result.first = correlator.CalculateOffset(vBufferA, vBufferB);
     if(result.first < 0)
     {
         nOffsetB = static_cast<size_t>(-result.first);
@@ -77,31 +72,22 @@ hashresult CalculateMinus(const std::deque<float>& bufferA, const std::deque<flo
 
         if(nSamples >= nSampleSize)
         {
-            std::vector<float> vTempA(nSamples);
-            std::vector<float> vTempB(nSamples);
-
-            for(int i = 0; i < nSamples; i++)
-            {
-                vTempA[i] = vBufferA[i+nOffsetA];
-                vTempB[i] = vBufferB[i+nOffsetB];
-            }
-
             pmlLog(pml::LOG_DEBUG) << "CalculateMinus\tComparing "<< nSamples << " samples [" << nSamplesA << "," << nSamplesB << "]";
 
-            auto vMinus = Minus(vTempA, vTempB);
+            auto vMinus = Minus(vBufferA.SubView(nOffsetA, nSamples), vBufferB.SubView(nOffsetB, nSamples));
             auto itMax = std::max_element(vMinus.begin(), vMinus.end());
             auto diff = std::max(thePeak.first, thePeak.second)/(*itMax);
 
             if(diff > 100 || (*itMax) < 0.0005) //ignore when less than 75dB
             {
-                g_conf = std::min(g_conf+0.1, 1.0);
-                result.second = g_conf;
+                dConfidence = std::min(dConfidence+0.1, 1.0);
+                result.second = dConfidence;
                 pmlLog(pml::LOG_DEBUG) << "CalculateMinus\tSAME\tMax difference = " << diff << "\t" << std::max(thePeak.first, thePeak.second) << ":" << (*itMax);
             }
             else
             {
-                g_conf = std::max(g_conf-0.1, 0.0);
-                result.second = g_conf;
+                dConfidence = std::max(dConfidence-0.1, 0.0);
+                result.second = dConfidence;
                 pmlLog(pml::LOG_DEBUG) << "CalculateMinus\tDIFF\tMax difference = " << diff << "\t" << std::max(thePeak.first, thePeak.second) << ":" << (*itMax);
             }
         }
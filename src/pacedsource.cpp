@@ -0,0 +1,97 @@
+#include "pacedsource.h"
+#include <chrono>
+#include "recorder.h"
+#include "agentthread.h"
+#include "log.h"
+
+PacedSource::PacedSource(Recorder& recorder, unsigned long nSampleRate, unsigned short nChannels, bool bRealTime) :
+AudioSource(recorder, nSampleRate, nChannels),
+m_bRealTime(bRealTime),
+m_bRun(false)
+{
+
+}
+
+PacedSource::~PacedSource()
+{
+    StopThread();
+}
+
+bool PacedSource::Start()
+{
+    if(m_pThread)
+    {
+        return true;
+    }
+    m_bRun = true;
+    m_pThread = std::make_unique<std::thread>(&PacedSource::ThreadLoop, this);
+    pmlLog(pml::LOG_INFO) << "PacedSource\tStarted " << (m_bRealTime ? "in real time" : "as fast as possible");
+    return true;
+}
+
+void PacedSource::Stop()
+{
+    StopThread();
+}
+
+void PacedSource::StopThread()
+{
+    m_bRun = false;
+    if(m_pThread)
+    {
+        m_pThread->join();
+        m_pThread = nullptr;
+    }
+}
+
+void PacedSource::WaitForCapture()
+{
+    while(m_recorder.BufferFull() && m_bRun && g_bRun)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+void PacedSource::ThreadLoop()
+{
+    std::vector<float> vBuffer(Recorder::FRAMES_PER_BUFFER*m_nChannels);
+
+    auto tpStart = std::chrono::steady_clock::now();
+    auto tpNext = tpStart;
+    unsigned long long nTotalFrames(0);
+
+    while(m_bRun && g_bRun)
+    {
+        size_t nFrames = FillBlock(vBuffer.data(), Recorder::FRAMES_PER_BUFFER);
+        if(nFrames < Recorder::FRAMES_PER_BUFFER)
+        {   //the last part block is dropped as the sound card only ever delivers whole blocks
+            break;
+        }
+
+        if(m_bRealTime)
+        {
+            tpNext += std::chrono::microseconds(Recorder::FRAMES_PER_BUFFER*1000000/m_nSampleRate);
+            std::this_thread::sleep_until(tpNext);
+        }
+        else
+        {
+            //don't overwrite a window Compi hasn't captured yet
+            WaitForCapture();
+        }
+
+        m_recorder.Callback(vBuffer.data(), nFrames);
+        nTotalFrames += nFrames;
+    }
+
+    //let Compi capture the final window before asking it to finish
+    WaitForCapture();
+
+    double dElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now()-tpStart).count();
+    double dAudio = static_cast<double>(nTotalFrames)/m_nSampleRate;
+    pmlLog(pml::LOG_INFO) << "PacedSource\tFinished: " << dAudio << "s of audio in " << dElapsed << "s (" << (dElapsed > 0.0 ? dAudio/dElapsed : 0.0) << "x real time)";
+
+    if(m_bRun)
+    {   //ran out of audio rather than being stopped
+        g_bRun = false;
+    }
+}
@@ -0,0 +1,181 @@
+#include "portaudiosource.h"
+#include "recorder.h"
+#include "log.h"
+
+static_assert(paInputUnderflow == Recorder::INPUT_UNDERFLOW && paInputOverflow == Recorder::INPUT_OVERFLOW, "Recorder flags must match PortAudio's");
+
+int paCallback( const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void *userData )
+{
+    if(input)
+    {
+        //Recorder's flags have the same values as PortAudio's
+        reinterpret_cast<Recorder*>(userData)->Callback(reinterpret_cast<const float*>(input), frameCount, statusFlags & (paInputUnderflow | paInputOverflow));
+    }
+    return 0;
+}
+
+
+PortAudioSource::PortAudioSource(Recorder& recorder, const std::string& sDeviceName, unsigned long nSampleRate, unsigned short nChannels) :
+AudioSource(recorder, nSampleRate, nChannels),
+m_sDeviceName(sDeviceName),
+m_nDeviceId(-1),
+m_bInitialised(false),
+m_pStream(nullptr)
+{
+
+}
+
+PortAudioSource::PortAudioSource(Recorder& recorder, short nDeviceId, unsigned long nSampleRate, unsigned short nChannels) :
+AudioSource(recorder, nSampleRate, nChannels),
+m_sDeviceName(""),
+m_nDeviceId(nDeviceId),
+m_bInitialised(false),
+m_pStream(nullptr)
+{
+
+}
+
+PortAudioSource::~PortAudioSource()
+{
+    Stop();
+    if(m_bInitialised)
+    {
+        Pa_Terminate();
+    }
+}
+
+bool PortAudioSource::Open()
+{
+    PaError err = Pa_Initialize();
+    if( err != paNoError )
+    {
+        pmlLog(pml::LOG_CRITICAL) << "PortAudioSource\tUnable to init port audio:" <<  Pa_GetErrorText(err);
+        Pa_Terminate();
+        return false;
+    }
+    m_bInitialised = true;
+
+    //get the device Id or name
+    if(m_nDeviceId == -1)
+    {
+        m_nDeviceId = GetDeviceId(m_sDeviceName);
+        if(m_nDeviceId == -1)
+        {
+            pmlLog(pml::LOG_CRITICAL)  << "PortAudioSource\tDevice " << m_sDeviceName << " does not exist";
+            return false;
+        }
+    }
+    else
+    {
+        m_sDeviceName = GetDeviceName(m_nDeviceId);
+        if(m_sDeviceName.empty())
+        {
+            pmlLog(pml::LOG_CRITICAL)  << "PortAudioSource\tDevice " << m_nDeviceId << " does not exist";
+            return false;
+        }
+    }
+
+
+
+
+    //Open the stream
+
+    PaStreamParameters inputParameters;
+    inputParameters.channelCount = m_nChannels;
+    inputParameters.device = m_nDeviceId;
+    inputParameters.hostApiSpecificStreamInfo = NULL;
+    inputParameters.sampleFormat = paFloat32;
+    inputParameters.suggestedLatency = 0;
+    inputParameters.hostApiSpecificStreamInfo = NULL;
+
+    err = Pa_IsFormatSupported(&inputParameters, 0, m_nSampleRate);
+    if(err != paNoError)
+    {
+        pmlLog(pml::LOG_CRITICAL)  << "PortAudioSource\tInput paramaters are not supported: " <<  Pa_GetErrorText(err);
+        return false;
+    }
+
+    err = Pa_OpenStream(&m_pStream, &inputParameters, 0, m_nSampleRate, Recorder::FRAMES_PER_BUFFER, paNoFlag, paCallback, reinterpret_cast<void*>(&m_recorder) );
+    if(err != paNoError)
+    {
+        pmlLog(pml::LOG_CRITICAL)  << "PortAudioSource\tUnable to open stream: " << Pa_GetErrorText(err);
+        return false;
+    }
+
+    const PaStreamInfo* pInfo = Pa_GetStreamInfo(m_pStream);
+    if(pInfo)
+    {
+        pmlLog(pml::LOG_INFO)  << "PortAudioSource\tStream opened: Latency " << pInfo->inputLatency << " SampleRate " << pInfo->sampleRate;
+
+        m_nSampleRate = pInfo->sampleRate;
+    }
+
+    return true;
+}
+
+short PortAudioSource::GetDeviceId(const std::string& sDeviceName)
+{
+    //enum the devices....
+    int nDevices;
+    nDevices = Pa_GetDeviceCount();
+    if( nDevices < 0 )
+    {
+        pmlLog(pml::LOG_CRITICAL)  << "PortAudioSource\tUnable to get devices: " <<  Pa_GetErrorText(nDevices);
+        return -1;
+    }
+
+    for(int i = 0; i < nDevices; i++)
+    {
+        const PaDeviceInfo* pDevInfo = Pa_GetDeviceInfo(i);
+        if(pDevInfo->name == sDeviceName)
+        {
+            pmlLog(pml::LOG_INFO) << "PortAudioSource\tDevice " << sDeviceName << " found. Id is " <<  i;
+            return i;
+        }
+        else
+        {
+            pmlLog(pml::LOG_INFO) << "PortAudioSource\tInput " << i << " is called " <<  std::string(pDevInfo->name);
+        }
+    }
+    return -1;
+}
+
+std::string PortAudioSource::GetDeviceName(short nDeviceId)
+{
+    const PaDeviceInfo* pDevInfo = Pa_GetDeviceInfo(nDeviceId);
+    if(pDevInfo)
+    {
+        pmlLog(pml::LOG_INFO) << "PortAudioSource\tDevice " << nDeviceId << " found. Name is " <<  pDevInfo->name;
+        return pDevInfo->name;
+    }
+    else
+    {
+        pmlLog(pml::LOG_ERROR) << "PortAudioSource\tCould not find device " << nDeviceId;
+        return "";
+    }
+}
+
+
+
+bool PortAudioSource::Start()
+{
+    PaError err = Pa_StartStream(m_pStream);
+    if(err != paNoError)
+    {
+        pmlLog(pml::LOG_CRITICAL)  << "PortAudioSource\tUnable to start stream: " << Pa_GetErrorText(err);;
+        return false;
+    }
+    pmlLog(pml::LOG_INFO) << "PortAudioSource\tRecording started";
+    return true;
+
+}
+
+void PortAudioSource::Stop()
+{
+    if(m_pStream)
+    {
+        Pa_StopStream(m_pStream);
+        Pa_CloseStream(m_pStream);
+        m_pStream = nullptr;
+    }
+}
@@ -1,11 +1,16 @@
 #include "spectrumcompare.h"
 #include "hash.h"
 #include "log.h"
-#include <fstream>
+#include "workerpool.h"
+#include "fftengine.h"
+#include "spectrumprofile.h"
+#include <dirent.h>
+#include <cmath>
 
-SpectrumCompare::SpectrumCompare(const std::string& sProfileFile, unsigned long nSampleRate,unsigned long nFramesForGood, unsigned long nFramesForCurrent, double dMaxAllowedLevelDiff, unsigned long nMaxAllowedBandsDiff) :
+SpectrumCompare::SpectrumCompare(const std::string& sProfileFile, unsigned long nSampleRate,unsigned long nFramesForGood, unsigned long nFramesForCurrent, double dMaxAllowedLevelDiff, unsigned long nMaxAllowedBandsDiff, unsigned long nHop) :
     m_sProfileFile(sProfileFile),
     m_nSampleRate(nSampleRate),
+    m_nHop((nHop > 0 && nHop < m_nFrameSamples) ? nHop : m_nFrameSamples),
     m_dFramesForGood(nFramesForGood),
     m_dFramesForCurrent(nFramesForCurrent),
     m_dMaxLevel(dMaxAllowedLevelDiff),
@@ -16,6 +21,8 @@ SpectrumCompare::SpectrumCompare(const std::string& sProfileFile, unsigned long
 {
     m_fftOut.first.resize(BINS);
     m_fftOut.second.resize(BINS);
+    m_vLevel.first.resize(BINS);
+    m_vLevel.second.resize(BINS);
 
     LoadProfileFile();
 }
@@ -25,18 +32,18 @@ SpectrumCompare::~SpectrumCompare()
 
 }
 
-hashresult SpectrumCompare::AddAudio(const std::deque<float>& bufferA, const std::deque<float>& bufferB)
+hashresult SpectrumCompare::AddAudio(const AudioView& bufferA, const AudioView& bufferB)
 {
     // add audio to our buffer
-    std::copy(bufferA.begin(), bufferA.end(), std::back_inserter(m_Buffer.first));
-    std::copy(bufferB.begin(), bufferB.end(), std::back_inserter(m_Buffer.second));
+    m_Buffer.first.Append(bufferA.data(), bufferA.size());
+    m_Buffer.second.Append(bufferB.data(), bufferB.size());
 
     if(!m_bOneShot || !m_bCalculated)
     {
         CalculateChannelOffset();
     }
 
-    if(m_Buffer.first.size() >= bufferA.size()+m_nWindowSamples && m_Buffer.second.size() >= bufferB.size()+m_nWindowSamples)
+    if(m_Buffer.first.GetSize() >= bufferA.size()+m_nWindowSamples && m_Buffer.second.GetSize() >= bufferB.size()+m_nWindowSamples)
     {
         ProcessAudio();
     }
@@ -47,69 +54,87 @@ hashresult SpectrumCompare::AddAudio(const std::deque<float>& bufferA, const std
 
 void SpectrumCompare::ProcessAudio()
 {
-    unsigned long nMaxBands = 0;
-
-    pmlLog(pml::LOG_DEBUG) << "SpectrumCompare::ProcessAudio: " << m_Buffer.first.size() << ", " << m_Buffer.second.size() << "\t" << m_dTotalFrames;
-    while(std::min(m_Buffer.first.size(), m_Buffer.second.size()) > (m_fftOut.first.size()-1)*2)
+    pmlLog(pml::LOG_DEBUG) << "SpectrumCompare::ProcessAudio: " << m_Buffer.first.GetSize() << ", " << m_Buffer.second.GetSize() << "\t" << m_dTotalFrames;
+    while(std::min(m_Buffer.first.GetSize(), m_Buffer.second.GetSize()) > m_nFrameSamples)
     {
         if(!m_bLive)
         {
-            CalculateSpectrum(m_vSpectrumGood);
+            CalculateSpectrum(m_vSpectrumGood, 1.0/(m_dTotalFrames+1));
             m_result.second = 0.0;
             CheckGoLive();
         }
+        else if(m_dTimeConstant > 0.0)
+        {
+            //running average - use the plain mean until there are enough frames for the time constant so the start isn't biased towards 0
+            CalculateSpectrum(m_vSpectrumCurrent, std::max(1.0/(m_dTotalFrames+1), 1.0/m_dTimeConstant));
+            m_nSinceCompare++;
+            if(m_dTotalFrames >= m_dTimeConstant && m_nSinceCompare >= m_nCompareEvery)
+            {
+                UpdateResult();
+                m_nSinceCompare = 0;
+            }
+        }
         else
         {
-            CalculateSpectrum(m_vSpectrumCurrent);
+            CalculateSpectrum(m_vSpectrumCurrent, 1.0/(m_dTotalFrames+1));
             //Compare this spectrum against the one we've stored
             if(m_dTotalFrames > m_dFramesForCurrent)
             {
-                nMaxBands  = std::max(nMaxBands, CompareSpectrums());
-
-                pmlLog(pml::LOG_INFO) << "SpectrumCompare\t Good=" << m_vSpectrumGood[128] << "\tCurrent=" << m_vSpectrumCurrent[128] << "\tBands=" << nMaxBands;
-
-
-                if(nMaxBands <= m_nMaxBands)
-                {
-                    m_result.second = std::min(1.0, m_result.second+0.3);
-                }
-                else
-                {
-                    m_result.second = std::max(0.0, m_result.second-0.3);
-                }
+                UpdateResult();
 
                 m_vSpectrumCurrent = std::vector<float>(BINS,0.0);
                 m_dTotalFrames = 0.0;
             }
         }
     }
+}
 
+void SpectrumCompare::UpdateResult()
+{
+    unsigned long nBands = CompareSpectrums();
 
+    pmlLog(pml::LOG_INFO) << "SpectrumCompare\t Good=" << m_vProfiles[m_nProfile].second[128] << "\tCurrent=" << m_vSpectrumCurrent[128] << "\tBands=" << nBands << "\tProfile=" << m_vProfiles[m_nProfile].first;
 
+    if(nBands <= m_nMaxBands)
+    {
+        m_result.second = std::min(1.0, m_result.second+0.3);
+    }
+    else
+    {
+        m_result.second = std::max(0.0, m_result.second-0.3);
+    }
+}
 
+void SpectrumCompare::SetRunningAverage(unsigned long nTimeConstant)
+{
+    m_dTimeConstant = nTimeConstant;
+    m_nCompareEvery = std::max(1ul, nTimeConstant/4);
+    m_nSinceCompare = 0;
+    if(nTimeConstant > 0)
+    {
+        pmlLog(pml::LOG_INFO) << "SpectrumCompare\tRunning average of current spectrum. Time constant " << nTimeConstant << " frames";
+    }
 }
 
-void SpectrumCompare::CalculateSpectrum(std::vector<float>& vSpectrum)
+void SpectrumCompare::CalculateSpectrum(std::vector<float>& vSpectrum, double dWeight)
 {
-    FFT(m_Buffer.first, m_fftOut.first);
-    FFT(m_Buffer.second, m_fftOut.second);
+    GetWorkerPool().Run([this]{ FFT(m_Buffer.first.GetData(), m_fftOut.first, m_vLevel.first); }, [this]{ FFT(m_Buffer.second.GetData(), m_fftOut.second, m_vLevel.second); });
+    m_Buffer.first.Consume(m_nHop);
+    m_Buffer.second.Consume(m_nHop);
 
     //m_dBinSize = static_cast<double>(m_nSampleRate)/static_cast<double>((m_fftOut.first.size()-1)*2);
 
-    for(size_t i = 0; i < m_fftOut.first.size(); i++)
+    for(size_t i = 0; i < m_vLevel.first.size(); i++)
     {
-        auto dAmplitudeA = abs(sqrt( (m_fftOut.first[i].r*m_fftOut.first[i].r) + (m_fftOut.first[i].i*m_fftOut.first[i].i)))/static_cast<float>(m_fftOut.first.size());
-        auto dAmplitudeB = abs(sqrt( (m_fftOut.second[i].r*m_fftOut.second[i].r) + (m_fftOut.second[i].i*m_fftOut.second[i].i)))/static_cast<float>(m_fftOut.second.size());
-
-        if(dAmplitudeA > 0.00003 && dAmplitudeB > 0.00003)  //works out at about -68dB
+        if(m_vLevel.first[i] > MIN_LEVEL && m_vLevel.second[i] > MIN_LEVEL)
         {
-            float dLogA = (20*log10(dAmplitudeA))* 0.754;
-            float dLogB = (20*log10(dAmplitudeB))* 0.754;
+            float dLogA = m_vLevel.first[i]* 0.754;
+            float dLogB = m_vLevel.second[i]* 0.754;
 
             float dLog = -dLogA+dLogB;
 
             auto oldAverage = vSpectrum[i];
-            vSpectrum[i] = oldAverage + ((dLog-oldAverage)/(m_dTotalFrames+1));
+            vSpectrum[i] = oldAverage + ((dLog-oldAverage)*dWeight);
         }
     }
 
@@ -118,34 +143,11 @@ void SpectrumCompare::CalculateSpectrum(std::vector<float>& vSpectrum)
 }
 
 
-void SpectrumCompare::FFT(std::list<float>& buffer, std::vector<kiss_fft_cpx>& vOut)
+void SpectrumCompare::FFT(const float* pFrame, std::vector<kiss_fft_cpx>& vOut, std::vector<float>& vLevel)
 {
     pmlLog(pml::LOG_TRACE) << "SpectrumCompare\t FFT";
-    std::vector<kiss_fft_scalar> vfft_in((vOut.size()-1)*2);
-
-    for(size_t i = 0; i < vfft_in.size(); i++)
-    {
-        if(buffer.empty() == false)
-        {
-            vfft_in[i] = HannWindow(buffer.front(), i, vfft_in.size());
-            buffer.pop_front();
-        }
-        else
-        {
-            vfft_in[i] = 0.0;
-        }
-    }
-
-    //Now do the check
-    kiss_fftr_cfg cfg;
-
-    pmlLog(pml::LOG_TRACE) << "SpectrumCompare\t FFT Kiss";
-    if ((cfg = kiss_fftr_alloc(vfft_in.size(), 0, NULL, NULL)) != NULL)
-    {
-        kiss_fftr(cfg, vfft_in.data(), vOut.data());
-    }
-    free(cfg);
-
+    GetFFTEngine(m_nFrameSamples).Transform(pFrame, vOut.data());
+    MagnitudeToDb(vOut.data(), vOut.size(), 1.0/static_cast<float>(vOut.size()), vLevel.data());
     pmlLog(pml::LOG_TRACE) << "SpectrumCompare\t FFT: Done";
 }
 
@@ -155,20 +157,19 @@ void SpectrumCompare::CalculateChannelOffset()
 {
     pmlLog(pml::LOG_TRACE) << "SpectrumCompare\tCalculateChannelOffset";
 
-    if(m_Buffer.first.size() >= m_nWindowSamples && m_Buffer.second.size() >= m_nWindowSamples)
+    if(m_Buffer.first.GetSize() >= m_nWindowSamples && m_Buffer.second.GetSize() >= m_nWindowSamples)
     {
         // calculate delay
-        m_result.first = CalculateOffset(std::vector<float>(m_Buffer.first.begin(), std::next(m_Buffer.first.begin(),m_nWindowSamples)),
-                                      std::vector<float>(m_Buffer.second.begin(), std::next(m_Buffer.second.begin(), m_nWindowSamples)));
+        m_result.first = CalculateOffset(AudioView(m_Buffer.first.GetData(), m_nWindowSamples), AudioView(m_Buffer.second.GetData(), m_nWindowSamples));
 
         // remove samples from leading side so that buffer is aligned
         if(m_result.first < -static_cast<int>(m_nAccuracy))
         {
-            m_Buffer.second.erase(m_Buffer.second.begin(), std::next(m_Buffer.second.begin(), -m_result.first));
+            m_Buffer.second.Consume(-m_result.first);
         }
         else if(m_result.first > static_cast<int>(m_nAccuracy))
         {
-            m_Buffer.first.erase(m_Buffer.first.begin(), std::next(m_Buffer.first.begin(), m_result.first));
+            m_Buffer.first.Consume(m_result.first);
         }
 
         m_bCalculated = true;
@@ -178,18 +179,50 @@ void SpectrumCompare::CalculateChannelOffset()
 
 unsigned long SpectrumCompare::CompareSpectrums()
 {
-    unsigned long nBands = 0;
-    for(size_t i = 0; i < m_vSpectrumGood.size(); i++)
+    //start with the profile that matched last time - the content rarely changes between comparisons so its count is usually
+    //the bound that lets the other profiles give up after a block or two
+    size_t nLast = m_nProfile;
+    unsigned long nBest = CountBands(m_vProfiles[nLast].second, BINS+1);
+
+    for(size_t i = 0; i < m_vProfiles.size() && nBest > 0; i++)
     {
-        if(abs(m_vSpectrumGood[i] - m_vSpectrumCurrent[i]) > m_dMaxLevel)
+        if(i != nLast)
         {
-            nBands++;
+            unsigned long nBands = CountBands(m_vProfiles[i].second, nBest);
+            if(nBands < nBest)
+            {
+                nBest = nBands;
+                m_nProfile = i;
+            }
         }
     }
 
+    if(m_nProfile != nLast)
+    {
+        pmlLog(pml::LOG_INFO) << "SpectrumCompare\tBest match now profile '" << m_vProfiles[m_nProfile].first << "'";
+    }
+    return nBest;
+}
 
+unsigned long SpectrumCompare::CountBands(const std::vector<float>& vProfile, unsigned long nLimit) const
+{
+    //count a block at a time so the inner loop vectorises, and stop as soon as this profile can't beat nLimit
+    const float dMaxLevel = m_dMaxLevel;
+    unsigned long nBands = 0;
+    for(size_t nStart = 0; nStart < BINS && nBands < nLimit; nStart += BAND_BLOCK)
+    {
+        for(size_t i = nStart; i < nStart+BAND_BLOCK; i++)
+        {
+            nBands += std::fabs(vProfile[i] - m_vSpectrumCurrent[i]) > dMaxLevel;
+        }
+    }
     return nBands;
+}
 
+const std::string& SpectrumCompare::GetProfileName() const
+{
+    static const std::string NONE;
+    return m_vProfiles.empty() ? NONE : m_vProfiles[m_nProfile].first;
 }
 
 
@@ -199,71 +232,116 @@ void SpectrumCompare::CheckGoLive()
     {
         pmlLog(pml::LOG_INFO) << "SpectrumCompare\tGoLive";
         SaveProfileFile();
+        m_vProfiles.insert(m_vProfiles.begin(), std::make_pair("learnt", m_vSpectrumGood));
+        m_nProfile = 0;
         m_bLive = true;
         m_dTotalFrames = 0;
         m_bCalculated = false;
-        m_Buffer.first.clear();
-        m_Buffer.second.clear();
+        m_Buffer.first.Clear();
+        m_Buffer.second.Clear();
     }
 }
 
 
+bool SpectrumCompare::LoadProfile(const std::string& sPath, std::vector<float>& vSpectrum)
+{
+    spectrumProfile profile;
+    bool bSuccess(false);
+    if(IsBinaryProfile(sPath))
+    {
+        bSuccess = LoadBinaryProfile(sPath, profile);
+    }
+    else if(LoadTextProfile(sPath, profile))
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumCompare\tProfile file " << sPath << " is in the old text format";
+        bSuccess = true;
+    }
+
+    if(!bSuccess)
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumCompare\tProfile file " << sPath << " invalid - could not load";
+    }
+    else if(profile.vSpectrum.size() != BINS)
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumCompare\tProfile file " << sPath << " invalid - " << profile.vSpectrum.size() << " bins, expected " << BINS;
+    }
+    else if(profile.nSampleRate != 0 && profile.nSampleRate != m_nSampleRate)
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumCompare\tProfile file " << sPath << " invalid - learnt at " << profile.nSampleRate << "Hz, running at " << m_nSampleRate << "Hz";
+    }
+    else
+    {
+        vSpectrum = std::move(profile.vSpectrum);
+        pmlLog() << "SpectrumCompare\tLoaded spectrum profile file " << sPath << " (" << profile.nFrames << " frames)";
+        return true;
+    }
+    return false;
+}
+
 void SpectrumCompare::LoadProfileFile()
 {
     pmlLog(pml::LOG_WARN) << "SpectrumCompare\tAttempt to load profile file " << m_sProfileFile;
-    std::ifstream ifs;
-    ifs.open(m_sProfileFile);
-    bool bSuccess(true);
-    if(ifs.is_open())
+
+    if(LoadProfile(m_sProfileFile, m_vSpectrumGood))
     {
-        m_vSpectrumGood.clear();
-        std::string sLine;
-        while(!ifs.eof())
-        {
-            getline(ifs,sLine,'\n');
-            if(sLine.empty() == false)
-            {
-                try
-                {
-                    m_vSpectrumGood.push_back(std::stod(sLine));
-                }
-                catch(...)
-                {
-                    pmlLog(pml::LOG_WARN) << "SpectrumCompare\tProfile file invalid - can't convert all entries '" << sLine << "'Create new one...";
-                    bSuccess = false;
-                    break;
-                }
-            }
-        }
-        if(m_vSpectrumGood.size() != BINS || !bSuccess)
+        pmlLog() << "SpectrumCompare\tGo Live";
+        m_vProfiles.insert(m_vProfiles.begin(), std::make_pair("learnt", m_vSpectrumGood));
+        m_bLive = true;
+    }
+    else
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumCompare\tCreate new profile...";
+        m_vSpectrumGood = std::vector<float>(BINS,0.0);
+    }
+}
+
+void SpectrumCompare::LoadProfileLibrary(const std::string& sDirectory)
+{
+    DIR* pDir = opendir(sDirectory.c_str());
+    if(!pDir)
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumCompare\tCould not open profile library " << sDirectory;
+        return;
+    }
+
+    size_t nBefore = m_vProfiles.size();
+    while(dirent* pEntry = readdir(pDir))
+    {
+        std::string sName(pEntry->d_name);
+        std::string sPath = sDirectory+"/"+sName;
+        //skip hidden files, the temporary files SaveBinaryProfile writes and the learnt profile if it lives in the same place
+        if(sName.empty() || sName[0] == '.' || (sName.size() > 4 && sName.compare(sName.size()-4, 4, ".tmp") == 0) || sPath == m_sProfileFile)
         {
-            pmlLog(pml::LOG_WARN) << "SpectrumCompare\tProfile file invalid - incorrect number of entroes. Create new one...";
-            m_vSpectrumGood = std::vector<float>(1024,0.0);
+            continue;
         }
-        else
-        {
-            pmlLog() << "SpectrumCompare\tLoaded spectrum profile file. Go Live";
-            m_bLive = true;
 
+        std::vector<float> vSpectrum;
+        if(LoadProfile(sPath, vSpectrum))
+        {
+            m_vProfiles.push_back(std::make_pair(sName, std::move(vSpectrum)));
         }
     }
-    else
+    closedir(pDir);
+
+    pmlLog() << "SpectrumCompare\tProfile library " << sDirectory << ": " << (m_vProfiles.size()-nBefore) << " profiles";
+
+    if(!m_bLive && m_vProfiles.empty() == false)
     {
-        pmlLog(pml::LOG_WARN) << "SpectrumCompare\tProfile file invalid - could not open. Create new one...";
+        pmlLog() << "SpectrumCompare\tUsing profile library. Go Live";
+        m_bLive = true;
+        m_dTotalFrames = 0;
     }
 }
 
 void SpectrumCompare::SaveProfileFile()
 {
-    std::ofstream ofs;
-    ofs.open(m_sProfileFile);//, std::ios_base::out | std::ios_base::trunc);
-    if(ofs.is_open())
+    spectrumProfile profile;
+    profile.nSampleRate = m_nSampleRate;
+    profile.nFrames = m_dTotalFrames;
+    profile.vSpectrum = m_vSpectrumGood;
+
+    if(SaveBinaryProfile(m_sProfileFile, profile))
     {
-        for(const auto& value : m_vSpectrumGood)
-        {
-            ofs << value << "\n";
-        }
-        ofs.close();
         pmlLog() << "SpectrumCompare\tProfile file saved";
     }
     else
@@ -0,0 +1,185 @@
+#include "spectrumprofile.h"
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log.h"
+
+uint32_t ProfileChecksum(const float* pData, size_t nCount)
+{
+    //CRC-32 (IEEE 802.3), bitwise - profiles are only a few kilobytes
+    //one float at a time so that a large nCount can't overflow a byte count
+    uint32_t nCrc = 0xffffffff;
+    for(size_t i = 0; i < nCount; i++)
+    {
+        const uint8_t* pBytes = reinterpret_cast<const uint8_t*>(pData+i);
+        for(size_t nByte = 0; nByte < sizeof(float); nByte++)
+        {
+            nCrc ^= pBytes[nByte];
+            for(int nBit = 0; nBit < 8; nBit++)
+            {
+                nCrc = (nCrc >> 1) ^ (0xedb88320 & (0-(nCrc & 1)));
+            }
+        }
+    }
+    return ~nCrc;
+}
+
+bool IsBinaryProfile(const std::string& sPath)
+{
+    std::ifstream ifs(sPath, std::ios::binary);
+    char sMagic[4];
+    return ifs.read(sMagic, sizeof(sMagic)) && memcmp(sMagic, PROFILE_MAGIC, sizeof(sMagic)) == 0;
+}
+
+bool LoadBinaryProfile(const std::string& sPath, spectrumProfile& profile)
+{
+    int nFd = open(sPath.c_str(), O_RDONLY);
+    if(nFd == -1)
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumProfile\tCould not open " << sPath;
+        return false;
+    }
+
+    struct stat info;
+    if(fstat(nFd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(profileHeader)))
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumProfile\t" << sPath << " is too short to be a profile";
+        close(nFd);
+        return false;
+    }
+
+    if(static_cast<unsigned long long>(info.st_size) > SIZE_MAX)
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumProfile\t" << sPath << " is too big to be a profile";
+        close(nFd);
+        return false;
+    }
+
+    size_t nSize = info.st_size;
+    void* pMap = mmap(nullptr, nSize, PROT_READ, MAP_PRIVATE, nFd, 0);
+    close(nFd);
+    if(pMap == MAP_FAILED)
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumProfile\tCould not map " << sPath;
+        return false;
+    }
+
+    bool bOk(false);
+    const profileHeader* pHeader = reinterpret_cast<const profileHeader*>(pMap);
+    const float* pData = reinterpret_cast<const float*>(reinterpret_cast<const char*>(pMap)+sizeof(profileHeader));
+
+    if(memcmp(pHeader->sMagic, PROFILE_MAGIC, sizeof(PROFILE_MAGIC)) != 0)
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumProfile\t" << sPath << " is not a binary profile";
+    }
+    else if(pHeader->nVersion != PROFILE_VERSION)
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumProfile\t" << sPath << " is version " << pHeader->nVersion << ". Expected " << PROFILE_VERSION;
+    }
+    else if((nSize-sizeof(profileHeader))%sizeof(float) != 0 || pHeader->nBins != (nSize-sizeof(profileHeader))/sizeof(float))
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumProfile\t" << sPath << " is " << nSize << " bytes. Header says " << pHeader->nBins << " bins";
+    }
+    else if(ProfileChecksum(pData, pHeader->nBins) != pHeader->nChecksum)
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumProfile\t" << sPath << " checksum does not match";
+    }
+    else
+    {
+        profile.nSampleRate = pHeader->nSampleRate;
+        profile.nFrames = pHeader->nFrames;
+        profile.vSpectrum.assign(pData, pData+pHeader->nBins);
+        bOk = true;
+    }
+
+    munmap(pMap, nSize);
+    return bOk;
+}
+
+bool LoadTextProfile(const std::string& sPath, spectrumProfile& profile)
+{
+    std::ifstream ifs;
+    ifs.open(sPath);
+    if(!ifs.is_open())
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumProfile\tCould not open " << sPath;
+        return false;
+    }
+
+    profile.nSampleRate = 0;
+    profile.nFrames = 0;
+    profile.vSpectrum.clear();
+
+    std::string sLine;
+    while(!ifs.eof())
+    {
+        getline(ifs,sLine,'\n');
+        if(sLine.empty() == false)
+        {
+            try
+            {
+                profile.vSpectrum.push_back(std::stod(sLine));
+            }
+            catch(...)
+            {
+                pmlLog(pml::LOG_WARN) << "SpectrumProfile\tProfile file invalid - can't convert all entries '" << sLine << "'";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool SaveBinaryProfile(const std::string& sPath, const spectrumProfile& profile)
+{
+    profileHeader header;
+    memcpy(header.sMagic, PROFILE_MAGIC, sizeof(PROFILE_MAGIC));
+    header.nVersion = PROFILE_VERSION;
+    header.nSampleRate = profile.nSampleRate;
+    header.nBins = profile.vSpectrum.size();
+    header.nFrames = profile.nFrames;
+    header.nChecksum = ProfileChecksum(profile.vSpectrum.data(), profile.vSpectrum.size());
+    header.nReserved = 0;
+
+    std::string sTemp = sPath+".tmp";
+    int nFd = open(sTemp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(nFd == -1)
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumProfile\tCould not create " << sTemp;
+        return false;
+    }
+
+    size_t nData = profile.vSpectrum.size()*sizeof(float);
+    bool bOk = write(nFd, &header, sizeof(header)) == static_cast<ssize_t>(sizeof(header)) &&
+               write(nFd, profile.vSpectrum.data(), nData) == static_cast<ssize_t>(nData) &&
+               fsync(nFd) == 0;
+    close(nFd);
+
+    if(!bOk || rename(sTemp.c_str(), sPath.c_str()) != 0)
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumProfile\tCould not write " << sPath;
+        unlink(sTemp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SaveTextProfile(const std::string& sPath, const spectrumProfile& profile)
+{
+    std::ofstream ofs;
+    ofs.open(sPath);
+    if(!ofs.is_open())
+    {
+        pmlLog(pml::LOG_WARN) << "SpectrumProfile\tCould not create " << sPath;
+        return false;
+    }
+    for(const auto& value : profile.vSpectrum)
+    {
+        ofs << value << "\n";
+    }
+    return true;
+}
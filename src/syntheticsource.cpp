@@ -0,0 +1,169 @@
+#include "syntheticsource.h"
+#include <cmath>
+#include "recorder.h"
+#include "log.h"
+
+namespace
+{
+    const double TWO_PI = 2.0*M_PI;
+
+    size_t NextPowerOfTwo(size_t nValue)
+    {
+        size_t nPower(1);
+        while(nPower < nValue)
+        {
+            nPower <<= 1;
+        }
+        return nPower;
+    }
+}
+
+SyntheticSource::SyntheticSource(Recorder& recorder, unsigned long nSampleRate, unsigned short nChannels, bool bRealTime, const syntheticSettings& settings) :
+PacedSource(recorder, nSampleRate, nChannels, bRealTime),
+m_settings(settings),
+m_dAmplitude(std::pow(10.0, settings.dLevel/20.0)),
+m_vGenerators(nChannels/2),
+m_nFrame(0),
+m_nDuration(static_cast<unsigned long long>(std::max(0.0, settings.dDuration)*nSampleRate)),
+m_nDropoutEvery(static_cast<unsigned long long>(std::max(0.0, settings.dDropoutEvery)*nSampleRate)),
+m_nDropoutLength(static_cast<unsigned long long>(std::max(0.0, settings.dDropoutLength)*nSampleRate/1000.0))
+{
+
+}
+
+SyntheticSource::~SyntheticSource()
+{
+    StopThread();
+}
+
+syntheticSettings::enumSignal SyntheticSource::GetSignal(const std::string& sSignal)
+{
+    if(sSignal == "tone")
+    {
+        return syntheticSettings::TONE;
+    }
+    else if(sSignal == "noise")
+    {
+        return syntheticSettings::NOISE;
+    }
+    return syntheticSettings::MUSIC;
+}
+
+syntheticSettings::enumDropout SyntheticSource::GetDropout(const std::string& sLeg)
+{
+    if(sLeg == "a")
+    {
+        return syntheticSettings::DROP_A;
+    }
+    else if(sLeg == "both")
+    {
+        return syntheticSettings::DROP_BOTH;
+    }
+    return syntheticSettings::DROP_B;
+}
+
+bool SyntheticSource::Open()
+{
+    for(size_t i = 0; i < m_vGenerators.size(); i++)
+    {
+        long nDelay = std::lround((m_settings.dDelay + i*m_settings.dDelayStep)*m_nSampleRate/1000.0);
+
+        pairGenerator& generator(m_vGenerators[i]);
+        generator.rng.seed(m_settings.nSeed+i);
+        generator.nDelayA = nDelay < 0 ? -nDelay : 0;
+        generator.nDelayB = nDelay > 0 ? nDelay : 0;
+        generator.vHistory.assign(NextPowerOfTwo(std::labs(nDelay)+1), 0.0f);
+
+        pmlLog(pml::LOG_INFO) << "SyntheticSource\tPair " << i+1 << ": B leg delayed by " << nDelay << " samples (" << nDelay*1000.0/m_nSampleRate << "ms)";
+    }
+
+    pmlLog(pml::LOG_INFO) << "SyntheticSource\tSignal=" << m_settings.eSignal << "\tLevel=" << m_settings.dLevel << "dBFS\tInvertB=" << m_settings.bInvertB
+                          << "\tDropoutEvery=" << m_settings.dDropoutEvery << "s\tDuration=" << m_settings.dDuration << "s";
+    return true;
+}
+
+size_t SyntheticSource::FillBlock(float* pBuffer, size_t nFrames)
+{
+    if(m_nDuration != 0)
+    {
+        nFrames = std::min<unsigned long long>(nFrames, m_nDuration-std::min(m_nDuration, m_nFrame));
+    }
+
+    for(size_t i = 0; i < nFrames; i++, m_nFrame++)
+    {
+        bool bDropout = InDropout();
+        for(size_t nPair = 0; nPair < m_vGenerators.size(); nPair++)
+        {
+            pairGenerator& generator(m_vGenerators[nPair]);
+            size_t nMask = generator.vHistory.size()-1;
+            generator.vHistory[m_nFrame & nMask] = NextSample(generator);
+
+            float dA = generator.vHistory[(m_nFrame-generator.nDelayA) & nMask];
+            float dB = generator.vHistory[(m_nFrame-generator.nDelayB) & nMask];
+            if(m_settings.bInvertB)
+            {
+                dB = -dB;
+            }
+            if(bDropout)
+            {
+                dA = m_settings.eDropout == syntheticSettings::DROP_B ? dA : 0.0f;
+                dB = m_settings.eDropout == syntheticSettings::DROP_A ? dB : 0.0f;
+            }
+
+            pBuffer[i*m_nChannels+nPair*2] = dA;
+            pBuffer[i*m_nChannels+nPair*2+1] = dB;
+        }
+    }
+    return nFrames;
+}
+
+bool SyntheticSource::InDropout() const
+{
+    return m_nDropoutEvery != 0 && m_nFrame >= m_nDropoutEvery && (m_nFrame % m_nDropoutEvery) < m_nDropoutLength;
+}
+
+float SyntheticSource::NextSample(pairGenerator& generator)
+{
+    std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+
+    switch(m_settings.eSignal)
+    {
+        case syntheticSettings::TONE:
+            {
+                float dSample = m_dAmplitude*std::sin(generator.dPhase);
+                generator.dPhase = std::fmod(generator.dPhase + TWO_PI*m_settings.dFrequency/m_nSampleRate, TWO_PI);
+                return dSample;
+            }
+        case syntheticSettings::NOISE:
+            return m_dAmplitude*noise(generator.rng);
+        default:
+            {
+                if(generator.nNoteRemaining == 0)
+                {
+                    NextNote(generator);
+                }
+                generator.nNoteRemaining--;
+
+                //quick attack then an exponential decay over the note, with three harmonics and a little noise underneath so the signal never repeats
+                double dTime = static_cast<double>(generator.nNoteLength-generator.nNoteRemaining);
+                double dEnvelope = std::min(1.0, dTime*200.0/m_nSampleRate)*std::exp(-3.0*dTime/generator.nNoteLength);
+                double dTone = (std::sin(generator.dPhase) + 0.5*std::sin(2.0*generator.dPhase) + 0.25*std::sin(3.0*generator.dPhase))/1.75;
+                generator.dPhase = std::fmod(generator.dPhase + TWO_PI*generator.dNoteFrequency/m_nSampleRate, TWO_PI);
+
+                return m_dAmplitude*(0.9*generator.dNoteLevel*dEnvelope*dTone + 0.05*noise(generator.rng));
+            }
+    }
+}
+
+void SyntheticSource::NextNote(pairGenerator& generator)
+{
+    std::uniform_int_distribution<int> note(48, 84);           //midi notes C3 to C6
+    std::uniform_real_distribution<double> length(0.08, 0.4);   //seconds
+    std::uniform_real_distribution<double> level(0.3, 1.0);
+    std::bernoulli_distribution rest(0.15);
+
+    generator.nNoteLength = std::max<size_t>(1, static_cast<size_t>(length(generator.rng)*m_nSampleRate));
+    generator.nNoteRemaining = generator.nNoteLength;
+    generator.dNoteFrequency = rest(generator.rng) ? 0.0 : 440.0*std::pow(2.0, (note(generator.rng)-69)/12.0);
+    generator.dNoteLevel = generator.dNoteFrequency > 0.0 ? level(generator.rng) : 0.0;
+}
@@ -1,5 +1,8 @@
 #include "troughcompare.h"
 #include "hash.h"
+#include "correlator.h"
+#include "workerpool.h"
+#include "fftengine.h"
 #include <math.h>
 #include <iostream>
 #include "log.h"
@@ -9,36 +12,16 @@
 #include <numeric>
 #include <list>
 
-double g_confFFT = 0.0;
-unsigned int g_maxBands = 0;
-unsigned int g_minBands = 1024;
-std::list<size_t> g_lstAverage;
-double g_avBands = 0.0;
 
 
 std::vector<kiss_fft_cpx> DoFFT(std::vector<float>& buffer, unsigned int nBins)
 
 {
-    std::vector<kiss_fft_scalar> vfft_in((nBins-1)*2);
     std::vector<kiss_fft_cpx> vfft_out;
     vfft_out.resize(nBins);
 
-    pmlLog(pml::LOG_TRACE) << "CalculateTroughs\tCopy Samples";
-
-    for(size_t i = 0; i < vfft_in.size(); i++)
-    {
-        vfft_in[i] = HannWindow(buffer[i], i, vfft_in.size());
-    }
-
-    //Now do the check
-    kiss_fftr_cfg cfg;
     pmlLog(pml::LOG_TRACE) << "CalculateTroughs\tFFT";
-
-    if ((cfg = kiss_fftr_alloc(vfft_in.size(), 0, NULL, NULL)) != NULL)
-    {
-        kiss_fftr(cfg, vfft_in.data(), vfft_out.data());
-    }
-    free(cfg);
+    GetFFTEngine((nBins-1)*2).Transform(buffer.data(), vfft_out.data());
 
     return vfft_out;
 
@@ -47,8 +30,9 @@ std::vector<kiss_fft_cpx> DoFFT(std::vector<float>& buffer, unsigned int nBins)
 
 std::vector<std::pair<size_t, float>> GetSpectrumDiff(std::vector<float>& bufferA, std::vector<float>& bufferB, unsigned long nSampleRate,unsigned int nBins,double dLimits)
 {
-    auto vfft_outA = DoFFT(bufferA, nBins);
-    auto vfft_outB = DoFFT(bufferB, nBins);
+    std::vector<kiss_fft_cpx> vfft_outA;
+    std::vector<kiss_fft_cpx> vfft_outB;
+    GetWorkerPool().Run([&]{ vfft_outA = DoFFT(bufferA, nBins); }, [&]{ vfft_outB = DoFFT(bufferB, nBins); });
 
 
     double dBinSize = static_cast<double>(nSampleRate)/static_cast<double>((vfft_outA.size()-1)*2);
@@ -58,18 +42,15 @@ std::vector<std::pair<size_t, float>> GetSpectrumDiff(std::vector<float>& buffer
     std::vector<std::pair<size_t, float>> vSpectrum;
     vSpectrum.reserve(vfft_outA.size());
 
+    std::vector<float> vLogA(nBinEnd);
+    std::vector<float> vLogB(nBinEnd);
+    MagnitudeToDb(vfft_outA.data(), nBinEnd, 2.0/static_cast<float>(vfft_outA.size()), vLogA.data());
+    MagnitudeToDb(vfft_outB.data(), nBinEnd, 2.0/static_cast<float>(vfft_outB.size()), vLogB.data());
+
     for(size_t i = 0; i < nBinEnd; i++)
     {
-        auto dAmplitudeA = abs(sqrt( (vfft_outA[i].r*vfft_outA[i].r) + (vfft_outA[i].i*vfft_outA[i].i)))*2.0;
-        dAmplitudeA /= static_cast<float>(vfft_outA.size());
-        auto dLogA = 20*log10(dAmplitudeA);
-
-        auto dAmplitudeB = abs(sqrt( (vfft_outB[i].r*vfft_outB[i].r) + (vfft_outB[i].i*vfft_outB[i].i)))*2.0;
-        dAmplitudeB /= static_cast<float>(vfft_outB.size());
-        auto dLogB = 20*log10(dAmplitudeB);
-
-        auto dDiff = abs(-dLogA+dLogB);
-        if(dDiff > dLimits && dLogA > -80.0)
+        auto dDiff = abs(-vLogA[i]+vLogB[i]);
+        if(dDiff > dLimits && vLogA[i] > -80.0)
         {
             vSpectrum.push_back({i, dDiff});
         }
@@ -95,11 +76,12 @@ std::vector<std::pair<int, double>>  GetTroughs(std::vector<float>& buffer, unsi
     int nPeaks(0);
     bool bUp(false);
 
+    std::vector<float> vLog(nBinEnd+1);
+    MagnitudeToDb(vfft_out.data(), vLog.size(), 1.0/static_cast<float>(vfft_out.size()), vLog.data());
+
     for(size_t i = 0; i <= nBinEnd; i++)     //ignore abouve 12kHz
     {
-        auto dAmplitude = abs(sqrt( (vfft_out[i].r*vfft_out[i].r) + (vfft_out[i].i*vfft_out[i].i)));
-        dAmplitude /= static_cast<float>(vfft_out.size());
-        auto dLog = 20*log10(dAmplitude);
+        auto dLog = vLog[i];
 
         dLastPeak = std::max(dLog, dLastPeak);
 
@@ -136,11 +118,8 @@ std::vector<std::pair<int, double>>  GetTroughs(std::vector<float>& buffer, unsi
 //    return mTroughs;
 }
 
-hashresult CalculateFFTDiff(const std::deque<float>& bufferA, const std::deque<float>& bufferB, unsigned int nSampleSize, size_t nBands, double dLimits, double dChangeDown, double dChangeUp)
+hashresult CalculateFFTDiff(const AudioView& vBufferA, const AudioView& vBufferB, unsigned int nSampleSize, size_t nBands, double dLimits, double dChangeDown, double dChangeUp, fftDiffState& state, StreamingCorrelator& correlator)
 {
-    std::vector<float> vBufferA(std::begin(bufferA), std::end(bufferA));
-    std::vector<float> vBufferB(std::begin(bufferB), std::end(bufferB));
-
     unsigned int nBins = 512;
 
 
@@ -152,7 +131,7 @@ hashresult CalculateFFTDiff(const std::deque<float>& bufferA, const std::deque<f
     size_t nOffsetA(0);
     size_t nOffsetB(0);
 
-    result.first = CalculateOffset(vBufferA, vBufferB);
+    result.first = correlator.CalculateOffset(vBufferA, vBufferB);
     if(result.first < 0)
     {
         nOffsetB = static_cast<size_t>(-result.first);
@@ -167,8 +146,8 @@ hashresult CalculateFFTDiff(const std::deque<float>& bufferA, const std::deque<f
 
     if(nOffsetA+nSampleSize <= vBufferA.size() && nOffsetB+nSampleSize <= vBufferB.size())
     {
-        int nSamplesA(std::min(vBufferA.size()-nOffsetA, nSampleSize));
-        int nSamplesB(std::min(vBufferB.size()-nOffsetB, nSampleSize));
+        int nSamplesA(std::min<size_t>(vBufferA.size()-nOffsetA, nSampleSize));
+        int nSamplesB(std::min<size_t>(vBufferB.size()-nOffsetB, nSampleSize));
         int nSamples(std::min(nSamplesA, nSamplesB));
 
         size_t nWindow = nBins*2;
@@ -197,39 +176,39 @@ hashresult CalculateFFTDiff(const std::deque<float>& bufferA, const std::deque<f
 
             auto vDiff = GetSpectrumDiff(vTempA, vTempB, 48000, nBins, dLimits);
 
-            if(g_maxBands < vDiff.size())
+            if(state.nMaxBands < vDiff.size())
             {
-                g_maxBands = vDiff.size();
-                pmlLog(pml::LOG_DEBUG) << "Max Bands = " << g_maxBands;
+                state.nMaxBands = vDiff.size();
+                pmlLog(pml::LOG_DEBUG) << "Max Bands = " << state.nMaxBands;
             }
-            if(g_minBands > vDiff.size())
+            if(state.nMinBands > vDiff.size())
             {
-                g_minBands = vDiff.size();
-                pmlLog(pml::LOG_DEBUG) << "Min Bands = " << g_minBands;
+                state.nMinBands = vDiff.size();
+                pmlLog(pml::LOG_DEBUG) << "Min Bands = " << state.nMinBands;
             }
 
-            g_lstAverage.push_back(vDiff.size());
-            if(g_lstAverage.size() > 60)
+            state.lstBands.push_back(vDiff.size());
+            if(state.lstBands.size() > 60)
             {
-                g_lstAverage.pop_front();
+                state.lstBands.pop_front();
             }
 
-            auto sum = std::accumulate(g_lstAverage.begin(), g_lstAverage.end(),0);
-            g_avBands = sum/static_cast<double>(g_lstAverage.size());
+            auto sum = std::accumulate(state.lstBands.begin(), state.lstBands.end(),0);
+            double dAvBands = sum/static_cast<double>(state.lstBands.size());
 
 
-            pmlLog(pml::LOG_DEBUG) << "BANDS AV: " << g_avBands;
+            pmlLog(pml::LOG_DEBUG) << "BANDS AV: " << dAvBands;
 
 
-            if(g_avBands < nBands)
+            if(dAvBands < nBands)
             {
-                g_confFFT = std::min(g_confFFT+dChangeUp, 1.0);
-                result.second = g_confFFT;
+                state.dConfidence = std::min(state.dConfidence+dChangeUp, 1.0);
+                result.second = state.dConfidence;
             }
             else
             {
-                g_confFFT = std::max(g_confFFT-dChangeDown, 0.0);
-                result.second = g_confFFT;
+                state.dConfidence = std::max(state.dConfidence-dChangeDown, 0.0);
+                result.second = state.dConfidence;
             }
 
 
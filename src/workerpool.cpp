@@ -0,0 +1,122 @@
+#include "workerpool.h"
+#include "log.h"
+#include <algorithm>
+
+WorkerPool::WorkerPool(size_t nThreads)
+{
+    m_vThreads.reserve(nThreads);
+    for(size_t i = 0; i < nThreads; i++)
+    {
+        m_vThreads.emplace_back(&WorkerPool::ThreadLoop, this);
+    }
+    pmlLog(pml::LOG_INFO) << "WorkerPool\tStarted " << nThreads << " threads";
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        m_bStop = true;
+    }
+    m_cv.notify_all();
+
+    for(auto& th : m_vThreads)
+    {
+        th.join();
+    }
+}
+
+void WorkerPool::Run(const std::function<void()>& taskA, const std::function<void()>& taskB)
+{
+    batch theBatch;
+    theBatch.nRemaining = 1;
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        m_qTasks.push_back(std::make_pair(&taskB, &theBatch));
+    }
+    m_cv.notify_one();
+
+    taskA();
+
+    Wait(theBatch);
+}
+
+void WorkerPool::Run(const std::vector<std::function<void()>>& vTasks)
+{
+    if(vTasks.empty())
+    {
+        return;
+    }
+
+    batch theBatch;
+    theBatch.nRemaining = vTasks.size()-1;
+    {
+        std::lock_guard<std::mutex> lg(m_mutex);
+        for(size_t i = 1; i < vTasks.size(); i++)
+        {
+            m_qTasks.push_back(std::make_pair(&vTasks[i], &theBatch));
+        }
+    }
+    m_cv.notify_all();
+
+    vTasks[0]();
+
+    Wait(theBatch);
+}
+
+void WorkerPool::Wait(batch& theBatch)
+{
+    //run anything still queued ourselves rather than sit idle - this also stops nested calls from deadlocking
+    std::unique_lock<std::mutex> lck(m_mutex);
+    while(RunQueued(lck)){}
+    lck.unlock();
+
+    std::unique_lock<std::mutex> lckBatch(theBatch.mutex);
+    theBatch.cv.wait(lckBatch, [&theBatch]{ return theBatch.nRemaining == 0; });
+}
+
+bool WorkerPool::RunQueued(std::unique_lock<std::mutex>& lck)
+{
+    if(m_qTasks.empty())
+    {
+        return false;
+    }
+    task theTask = m_qTasks.front();
+    m_qTasks.pop_front();
+
+    lck.unlock();
+    Execute(theTask);
+    lck.lock();
+    return true;
+}
+
+void WorkerPool::Execute(const task& theTask)
+{
+    (*theTask.first)();
+
+    //notify while still holding the lock: as soon as nRemaining reaches 0 the caller may return and destroy the batch
+    std::lock_guard<std::mutex> lg(theTask.second->mutex);
+    --theTask.second->nRemaining;
+    theTask.second->cv.notify_all();
+}
+
+void WorkerPool::ThreadLoop()
+{
+    std::unique_lock<std::mutex> lck(m_mutex);
+    while(true)
+    {
+        m_cv.wait(lck, [this]{ return m_bStop || m_qTasks.empty() == false; });
+        if(m_bStop)
+        {
+            break;
+        }
+        RunQueued(lck);
+    }
+}
+
+WorkerPool& GetWorkerPool()
+{
+    //leave a core for the thread that calls Run
+    static WorkerPool pool(std::max(2u, std::thread::hardware_concurrency())-1);
+    return pool;
+}
@@ -0,0 +1,74 @@
+#include <iostream>
+#include <string>
+#include <memory>
+#include "spectrumprofile.h"
+#include "log.h"
+
+/** Converts spectrum profiles between the old one value per line text format and the binary format compi now loads **/
+
+static void Usage()
+{
+    std::cout << "Usage: compi_profile totext [binary file] [text file]" << std::endl;
+    std::cout << "       compi_profile tobinary [text file] [binary file] [sample rate]" << std::endl;
+    std::cout << "       compi_profile info [binary file]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    pmlLog().AddOutput(std::unique_ptr<pml::LogOutput>(new pml::LogOutput()));
+
+    if(argc < 3)
+    {
+        Usage();
+        return -1;
+    }
+
+    std::string sCommand(argv[1]);
+    spectrumProfile profile;
+
+    if(sCommand == "info")
+    {
+        if(!LoadBinaryProfile(argv[2], profile))
+        {
+            return -1;
+        }
+        std::cout << "Sample rate: " << profile.nSampleRate << "\nBins: " << profile.vSpectrum.size() << "\nFrames: " << profile.nFrames << std::endl;
+        return 0;
+    }
+    else if(sCommand == "totext" && argc >= 4)
+    {
+        if(!LoadBinaryProfile(argv[2], profile) || !SaveTextProfile(argv[3], profile))
+        {
+            return -1;
+        }
+    }
+    else if(sCommand == "tobinary" && argc >= 5)
+    {
+        if(!LoadTextProfile(argv[2], profile))
+        {
+            return -1;
+        }
+        try
+        {
+            profile.nSampleRate = std::stoul(argv[4]);
+        }
+        catch(...)
+        {
+            std::cout << "Invalid sample rate '" << argv[4] << "'" << std::endl;
+            return -1;
+        }
+
+        if(!SaveBinaryProfile(argv[3], profile))
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        Usage();
+        return -1;
+    }
+
+    std::cout << "Converted " << profile.vSpectrum.size() << " bins" << std::endl;
+    return 0;
+}